@@ -169,14 +169,14 @@ unsigned int BuildShaderProgram()
 		#version 330 core
 		layout (location = 0) in vec3 orig_pos;
 		layout (location = 4) in vec2 orig_tex_coord;
+		layout (location = 5) in mat4 instance_model; // one per cube, locations 5 to 8
 		out vec2 inter_tex_coord;
 
-		uniform mat4 model;
 		uniform mat4 view;
 		uniform mat4 projection;
 
 		void main() {
-			gl_Position = projection * view * model * vec4(orig_pos, 1.0);
+			gl_Position = projection * view * instance_model * vec4(orig_pos, 1.0);
 			inter_tex_coord = orig_tex_coord;
 		})";
 	vertex_shader = glCreateShader(GL_VERTEX_SHADER);
@@ -270,6 +270,25 @@ std::tuple<unsigned int, unsigned int, unsigned int> GetVaoVboEbo()
 	return { vao, vbo, ebo };
 }
 
+// per-instance model matrices, the attribute advances once per cube instead of once per vertex
+unsigned int GetInstanceVbo(unsigned int vao)
+{
+	unsigned int instance_vbo;
+	glGenBuffers(1, &instance_vbo);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+	for (unsigned int column = 0; column < 4; ++column)
+	{
+		glVertexAttribPointer(5 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+			(void*)(column * sizeof(glm::vec4)));
+		glEnableVertexAttribArray(5 + column);
+		glVertexAttribDivisor(5 + column, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	return instance_vbo;
+}
+
 std::tuple<unsigned int, unsigned int> LoadTexture(unsigned int shader_program)
 {
 	unsigned int container_tex, face_tex;
@@ -345,11 +364,12 @@ int main()
 		glm::vec3(-1.3f,  1.0f, -1.5f)
 	};
 
-	glm::mat4 model_matrix = glm::mat4(1.0f), view_matrix = glm::mat4(1.0f), projection_matrix;
+	glm::mat4 model_matrices[10], view_matrix = glm::mat4(1.0f), projection_matrix;
 	auto camera_position = glm::vec3(0.0f, 0.0f, 3.0f);
 	auto camera_up = glm::vec3(0.0f, 1.0f, 0.0f);
 
 	auto [vao, vbo, ebo] = GetVaoVboEbo();
+	const unsigned int instance_vbo = GetInstanceVbo(vao);
 	auto textures_id = LoadTexture(shader_program);
 
 	float delta_time_between_frames = 0.0f, last_frame_time = 0.0f;
@@ -372,7 +392,6 @@ int main()
 		glUniformMatrix4fv(view_location, 1, GL_FALSE, glm::value_ptr(view_matrix));
 		int projection_location = glGetUniformLocation(shader_program, "projection");
 		glUniformMatrix4fv(projection_location, 1, GL_FALSE, glm::value_ptr(projection_matrix));
-		int model_location = glGetUniformLocation(shader_program, "model");
 
 		float current_frame_time = glfwGetTime();
 		delta_time_between_frames = current_frame_time - last_frame_time;
@@ -380,16 +399,18 @@ int main()
 		for (int i = 0; i < 10; ++i)
 		{
 			float angle = 20.0f * i;
-			model_matrix = glm::translate(glm::mat4(1.0f), cube_positions[i]);
-			model_matrix = glm::rotate(model_matrix, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+			model_matrices[i] = glm::translate(glm::mat4(1.0f), cube_positions[i]);
+			model_matrices[i] = glm::rotate(model_matrices[i], glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
 			if (i == 0 || (i + 1) % 3 == 0)
 			{
-				model_matrix = glm::rotate(model_matrix, current_frame_time * 0.2f, glm::vec3(1.0f, 0.3f, 0.5f));
+				model_matrices[i] = glm::rotate(model_matrices[i], current_frame_time * 0.2f, glm::vec3(1.0f, 0.3f, 0.5f));
 			}
-			glUniformMatrix4fv(model_location, 1, GL_FALSE, glm::value_ptr(model_matrix));
-
-			glDrawArrays(GL_TRIANGLES, 0, 36);
 		}
+		// some cubes spin, so the matrices are re-sent every frame, then all cubes go in one draw
+		glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(model_matrices), model_matrices, GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 36, 10);
 		glBindVertexArray(0);
 		KeyboardCallback(window, &camera_position, camera_front_direction, camera_up, delta_time_between_frames);
 		glfwSwapBuffers(window);
@@ -398,6 +419,7 @@ int main()
 	glDeleteVertexArrays(1, &vao);
 	glDeleteBuffers(1, &vbo);
 	glDeleteBuffers(1, &ebo);
+	glDeleteBuffers(1, &instance_vbo);
 	glDeleteProgram(shader_program);
 	glfwTerminate();
 	return 0;
@@ -0,0 +1,30 @@
+#ifndef NORMAL_MATRIX_H
+#define NORMAL_MATRIX_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <cmath>
+
+// Matrix that takes object space normals to world space: the inverse-transpose of the upper
+// 3x3 of model. Compute it once per object on the CPU and pass it as "uniform mat3 normalMatrix"
+// instead of running transpose(inverse(model)) for every vertex.
+inline glm::mat3 normalMatrix(const glm::mat4& model)
+{
+	const glm::mat3 linear(model);
+	// rotation times uniform scale s (the common case): the columns are orthogonal and all of
+	// length s, so inverse(linear) == transpose(linear) / s^2 and the inverse-transpose is just
+	// linear / s^2, no inverse needed
+	const float scale2 = glm::dot(linear[0], linear[0]);
+	const float tolerance = 1e-5f * scale2;
+	if (scale2 > 0.0f
+		&& std::abs(glm::dot(linear[1], linear[1]) - scale2) <= tolerance
+		&& std::abs(glm::dot(linear[2], linear[2]) - scale2) <= tolerance
+		&& std::abs(glm::dot(linear[0], linear[1])) <= tolerance
+		&& std::abs(glm::dot(linear[0], linear[2])) <= tolerance
+		&& std::abs(glm::dot(linear[1], linear[2])) <= tolerance)
+		return linear / scale2;
+	// non-uniform scale or shear, fall back to the general 3x3 inverse
+	return glm::inverseTranspose(linear);
+}
+#endif
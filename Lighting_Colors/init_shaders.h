@@ -128,6 +128,28 @@ std::tuple<unsigned int, unsigned int> LoadTexture(unsigned int shader_program)
 	return { container_tex, face_tex };
 }
 
+// binding point of the std140 FrameConstants block (projection + view) shared by every program
+constexpr unsigned int FRAME_CONSTANTS_BINDING = 0;
+
+unsigned int CreateFrameConstantsUbo()
+{
+	unsigned int ubo;
+	glGenBuffers(1, &ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, ubo);
+	return ubo;
+}
+
+void UpdateFrameConstantsUbo(unsigned int ubo, const glm::mat4& projection_matrix, const glm::mat4& view_matrix)
+{
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(projection_matrix));
+	glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(view_matrix));
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
 unsigned int LinkToShaderProgram(unsigned int vertex_shader, unsigned int fragment_shader)
 {
 	glCompileShader(vertex_shader);
@@ -160,6 +182,10 @@ unsigned int LinkToShaderProgram(unsigned int vertex_shader, unsigned int fragme
 		glGetProgramInfoLog(shader_program, 512, NULL, info_log);
 		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << info_log << std::endl;
 	}
+	// any program declaring FrameConstants reads the shared camera buffer
+	const unsigned int frame_constants_index = glGetUniformBlockIndex(shader_program, "FrameConstants");
+	if (frame_constants_index != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader_program, frame_constants_index, FRAME_CONSTANTS_BINDING);
 	glDeleteShader(vertex_shader);
 	glDeleteShader(fragment_shader);
 	return shader_program;
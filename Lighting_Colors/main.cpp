@@ -18,9 +18,11 @@ unsigned int BuildObjShader()
 		#version 330 core
 		layout (location = 0) in vec3 orig_pos;
 
+		layout (std140) uniform FrameConstants {
+			mat4 projection;
+			mat4 view;
+		};
 		uniform mat4 model;
-		uniform mat4 view;
-		uniform mat4 projection;
 
 		void main() {
 			gl_Position = projection * view * model * vec4(orig_pos, 1.0);
@@ -47,9 +49,11 @@ unsigned int BuildLightShader()
 		#version 330 core
 		layout (location = 0) in vec3 aPos;
 
+		layout (std140) uniform FrameConstants {
+			mat4 projection;
+			mat4 view;
+		};
 		uniform mat4 model;
-		uniform mat4 view;
-		uniform mat4 projection;
 
 		void main() {
 			gl_Position = projection * view * model * vec4(aPos, 1.0);
@@ -81,6 +85,7 @@ int main()
 	const unsigned int obj_shader_program = BuildObjShader();
 	const unsigned int light_shader_program = BuildLightShader();
 	const auto [obj_vao, light_vao, vbo] = GetObjVaoLightVaoAndVbo();
+	const unsigned int frame_constants_ubo = CreateFrameConstantsUbo();
 	float delta_time_between_frames = 0.0f, last_frame_time = 0.0f;
 
 	const glm::vec3 obj_color(1.0f, 0.5, 0.31f);
@@ -99,12 +104,11 @@ int main()
 		glm::mat4 model_matrix = glm::mat4(1.0f);
 		glm::mat4 view_matrix = camera.GetViewMatrix();
 		glm::mat4 projection_matrix = glm::perspective(glm::radians(camera.zoom), 800.0f / 600.0f, 0.1f, 100.0f);
+		UpdateFrameConstantsUbo(frame_constants_ubo, projection_matrix, view_matrix);
 		glUseProgram(obj_shader_program);
 		glBindVertexArray(obj_vao);
 		glUniform3fv(glGetUniformLocation(obj_shader_program, "object_color"), 1, &obj_color[0]);
 		glUniform3fv(glGetUniformLocation(obj_shader_program, "light_color"), 1, &light_color[0]);
-		glUniformMatrix4fv(glGetUniformLocation(obj_shader_program, "view"), 1, GL_FALSE, glm::value_ptr(view_matrix));
-		glUniformMatrix4fv(glGetUniformLocation(obj_shader_program, "projection"), 1, GL_FALSE, glm::value_ptr(projection_matrix));
 		glUniformMatrix4fv(glGetUniformLocation(obj_shader_program, "model"), 1, GL_FALSE, glm::value_ptr(model_matrix));
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 
@@ -114,8 +118,6 @@ int main()
 		model_matrix = glm::scale(model_matrix, glm::vec3(0.2f));
 		glUseProgram(light_shader_program);
 		glBindVertexArray(light_vao);
-		glUniformMatrix4fv(glGetUniformLocation(light_shader_program, "view"), 1, GL_FALSE, glm::value_ptr(view_matrix));
-		glUniformMatrix4fv(glGetUniformLocation(light_shader_program, "projection"), 1, GL_FALSE, glm::value_ptr(projection_matrix));
 		glUniformMatrix4fv(glGetUniformLocation(light_shader_program, "model"), 1, GL_FALSE, glm::value_ptr(model_matrix));
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 
@@ -127,6 +129,7 @@ int main()
 	glDeleteVertexArrays(1, &obj_vao);
 	glDeleteVertexArrays(1, &light_vao);
 	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &frame_constants_ubo);
 	glDeleteProgram(obj_shader_program);
 	glfwTerminate();
 	return 0;
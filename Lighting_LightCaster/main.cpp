@@ -10,6 +10,7 @@
 #pragma warning(pop)
 #include "shaders.h"
 #include "camera.h"
+#include "normal_matrix.h"
 
 #include <iostream>
 #include <filesystem>
@@ -218,8 +219,8 @@ int main()
 
 	glm::vec3 lightPos(0.0f, 0.0f, -2.0f);
 	lightingShader.use();
-	lightingShader.setInt("material.diffuse", 0);
-	lightingShader.setInt("material.specular", 1);
+	lightingShader.setInt("material.diffuse"_u, 0);
+	lightingShader.setInt("material.specular"_u, 1);
 	
 	while (!glfwWindowShouldClose(window))
 	{
@@ -238,32 +239,33 @@ int main()
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
 		lightingShader.use();
-		lightingShader.setVec3("viewPos", camera.Position);
-		lightingShader.setVec3("light.position", camera.Position);
-		lightingShader.setVec3("light.direction", camera.Front);
-		lightingShader.setFloat("light.cutOff", glm::cos(glm::radians(12.5)));
-		lightingShader.setFloat("light.outerCutOff", glm::cos(glm::radians(17.5f)));
-
-		lightingShader.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-		lightingShader.setVec3("light.diffuse", 0.5f, 0.5f, 0.5f);
-		lightingShader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("light.constant", 1.0f);
-		lightingShader.setFloat("light.linear", 0.09f);
-		lightingShader.setFloat("light.quadratic", 0.032f);
-
-		lightingShader.setFloat("material.shininess", 64.0f);
+		lightingShader.setVec3("viewPos"_u, camera.Position);
+		lightingShader.setVec3("light.position"_u, camera.Position);
+		lightingShader.setVec3("light.direction"_u, camera.Front);
+		lightingShader.setFloat("light.cutOff"_u, glm::cos(glm::radians(12.5)));
+		lightingShader.setFloat("light.outerCutOff"_u, glm::cos(glm::radians(17.5f)));
+
+		lightingShader.setVec3("light.ambient"_u, 0.2f, 0.2f, 0.2f);
+		lightingShader.setVec3("light.diffuse"_u, 0.5f, 0.5f, 0.5f);
+		lightingShader.setVec3("light.specular"_u, 1.0f, 1.0f, 1.0f);
+		lightingShader.setFloat("light.constant"_u, 1.0f);
+		lightingShader.setFloat("light.linear"_u, 0.09f);
+		lightingShader.setFloat("light.quadratic"_u, 0.032f);
+
+		lightingShader.setFloat("material.shininess"_u, 64.0f);
 	
 		// view/projection transformations
 		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 		glm::mat4 view = camera.GetViewMatrix();
-		lightingShader.setMat4("projection", projection);
-		lightingShader.setMat4("view", view);
+		lightingShader.setMat4("projection"_u, projection);
+		lightingShader.setMat4("view"_u, view);
 
 		glBindVertexArray(cubeVAO);
 
 		// world transformation
 		glm::mat4 model = glm::mat4(1.0f);
-		lightingShader.setMat4("model", model);
+		lightingShader.setMat4("model"_u, model);
+		lightingShader.setMat3("normalMatrix"_u, normalMatrix(model));
 
 		// render the cube
 		glDrawArrays(GL_TRIANGLES, 0, 36);
@@ -273,7 +275,8 @@ int main()
 			glm::mat4 model = glm::mat4(1.0f);
 			model = glm::translate(model, cubePositions[i]);
 			model = glm::rotate(model, glm::radians(i * 20.0f), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
+			lightingShader.setMat4("model"_u, model);
+			lightingShader.setMat3("normalMatrix"_u, normalMatrix(model));
 			// render the cube
 			glDrawArrays(GL_TRIANGLES, 0, 36);
 		}
@@ -5,10 +5,51 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// FNV-1a, usable both at compile time (uniform name literals) and at run time (std::string names)
+constexpr std::uint64_t hashUniformName(const char* text, std::size_t length)
+{
+	std::uint64_t hash = 14695981039346656037ull;
+	for (std::size_t i = 0; i < length; i++)
+	{
+		hash ^= static_cast<unsigned char>(text[i]);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// a uniform name hashed at compile time, spelled "material.shininess"_u
+struct UniformName
+{
+	std::uint64_t hash;
+	const char* text; // only read for diagnostics
+};
+
+consteval UniformName operator""_u(const char* text, std::size_t length)
+{
+	return UniformName{ hashUniformName(text, length), text };
+}
+
+// opaque handle to an active uniform, resolve it once with Shader::uniform() and reuse it every frame
+class UniformHandle
+{
+public:
+	UniformHandle() = default;
+	bool valid() const { return location != -1; }
+
+private:
+	friend class Shader;
+	explicit UniformHandle(GLint location) : location(location) {}
+	GLint location = -1;
+};
+
 class Shader
 {
 public:
@@ -68,7 +109,8 @@ public:
 		// delete the shaders as they're linked into our program now and no longer necessary
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
-
+		// 3. enumerate the active uniforms once so the set* calls never go back to the driver
+		buildUniformTable();
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
@@ -76,66 +118,210 @@ public:
 	{
 		glUseProgram(ID);
 	}
-	// utility uniform functions
+	// look up an active uniform; unknown names give an invalid handle which set* silently ignores
 	// ------------------------------------------------------------------------
-	void setBool(const std::string& name, bool value) const
+	UniformHandle uniform(const std::string& name) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		const UniformEntry* entry = findUniform(hashUniformName(name.data(), name.size()));
+		if (entry == nullptr || entry->name != name)
+			return UniformHandle();
+		return UniformHandle(entry->location);
 	}
+	// compile-time hashed names skip string construction and hashing entirely; debug builds
+	// assert the name exists so typos are caught, release builds drop the check
 	// ------------------------------------------------------------------------
-	void setInt(const std::string& name, int value) const
+	UniformHandle uniform(UniformName name) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		const UniformEntry* entry = findUniform(name.hash);
+#ifndef NDEBUG
+		if (entry == nullptr)
+			std::cout << "ERROR::SHADER::UNKNOWN_UNIFORM: " << name.text << std::endl;
+#endif
+		assert(entry != nullptr && "uniform is not active in this program");
+		return entry != nullptr ? UniformHandle(entry->location) : UniformHandle();
 	}
+	// utility uniform functions, each takes a UniformHandle, a "name"_u literal or a std::string
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string& name, float value) const
+	void setBool(UniformHandle handle, bool value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(handle.location, (int)value);
+	}
+	template <typename Name>
+	void setBool(const Name& name, bool value) const
+	{
+		setBool(uniform(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string& name, const glm::vec2& value) const
+	void setInt(UniformHandle handle, int value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform1i(handle.location, value);
 	}
-	void setVec2(const std::string& name, float x, float y) const
+	template <typename Name>
+	void setInt(const Name& name, int value) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		setInt(uniform(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string& name, const glm::vec3& value) const
+	void setFloat(UniformHandle handle, float value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform1f(handle.location, value);
 	}
-	void setVec3(const std::string& name, float x, float y, float z) const
+	template <typename Name>
+	void setFloat(const Name& name, float value) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		setFloat(uniform(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string& name, const glm::vec4& value) const
+	void setVec2(UniformHandle handle, const glm::vec2& value) const
+	{
+		glUniform2fv(handle.location, 1, &value[0]);
+	}
+	void setVec2(UniformHandle handle, float x, float y) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2f(handle.location, x, y);
 	}
-	void setVec4(const std::string& name, float x, float y, float z, float w) const
+	template <typename Name>
+	void setVec2(const Name& name, const glm::vec2& value) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		setVec2(uniform(name), value);
+	}
+	template <typename Name>
+	void setVec2(const Name& name, float x, float y) const
+	{
+		setVec2(uniform(name), x, y);
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string& name, const glm::mat2& mat) const
+	void setVec3(UniformHandle handle, const glm::vec3& value) const
+	{
+		glUniform3fv(handle.location, 1, &value[0]);
+	}
+	void setVec3(UniformHandle handle, float x, float y, float z) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniform3f(handle.location, x, y, z);
+	}
+	template <typename Name>
+	void setVec3(const Name& name, const glm::vec3& value) const
+	{
+		setVec3(uniform(name), value);
+	}
+	template <typename Name>
+	void setVec3(const Name& name, float x, float y, float z) const
+	{
+		setVec3(uniform(name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string& name, const glm::mat3& mat) const
+	void setVec4(UniformHandle handle, const glm::vec4& value) const
+	{
+		glUniform4fv(handle.location, 1, &value[0]);
+	}
+	void setVec4(UniformHandle handle, float x, float y, float z, float w) const
+	{
+		glUniform4f(handle.location, x, y, z, w);
+	}
+	template <typename Name>
+	void setVec4(const Name& name, const glm::vec4& value) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setVec4(uniform(name), value);
+	}
+	template <typename Name>
+	void setVec4(const Name& name, float x, float y, float z, float w) const
+	{
+		setVec4(uniform(name), x, y, z, w);
+	}
+	// ------------------------------------------------------------------------
+	void setMat2(UniformHandle handle, const glm::mat2& mat) const
+	{
+		glUniformMatrix2fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+	}
+	template <typename Name>
+	void setMat2(const Name& name, const glm::mat2& mat) const
+	{
+		setMat2(uniform(name), mat);
+	}
+	// ------------------------------------------------------------------------
+	void setMat3(UniformHandle handle, const glm::mat3& mat) const
+	{
+		glUniformMatrix3fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+	}
+	template <typename Name>
+	void setMat3(const Name& name, const glm::mat3& mat) const
+	{
+		setMat3(uniform(name), mat);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string& name, const glm::mat4& mat) const
+	void setMat4(UniformHandle handle, const glm::mat4& mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix4fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+	}
+	template <typename Name>
+	void setMat4(const Name& name, const glm::mat4& mat) const
+	{
+		setMat4(uniform(name), mat);
 	}
 
 private:
+	struct UniformEntry
+	{
+		std::uint64_t hash;
+		std::string name;
+		GLint location;
+	};
+	// sorted by hash so compile-time hashed names resolve with a binary search
+	std::vector<UniformEntry> uniformTable;
+
+	const UniformEntry* findUniform(std::uint64_t hash) const
+	{
+		auto it = std::lower_bound(uniformTable.begin(), uniformTable.end(), hash,
+			[](const UniformEntry& entry, std::uint64_t value) { return entry.hash < value; });
+		return (it != uniformTable.end() && it->hash == hash) ? &*it : nullptr;
+	}
+	// query every active uniform after link; each array element gets its own entry ("offsets[2]")
+	// ------------------------------------------------------------------------
+	void buildUniformTable()
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		uniformTable.clear();
+		std::vector<GLchar> buffer(maxLength > 0 ? maxLength : 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+			std::string name(buffer.data(), length);
+			GLint location = glGetUniformLocation(ID, name.c_str());
+			if (location == -1) // uniform block members have no location
+				continue;
+			addUniform(name, location);
+			// arrays of basic types are reported once as "name[0]"
+			if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			{
+				const std::string base = name.substr(0, name.size() - 3);
+				addUniform(base, location);
+				for (GLint element = 1; element < size; element++)
+				{
+					const std::string elementName = base + "[" + std::to_string(element) + "]";
+					addUniform(elementName, glGetUniformLocation(ID, elementName.c_str()));
+				}
+			}
+		}
+
+		std::sort(uniformTable.begin(), uniformTable.end(),
+			[](const UniformEntry& lhs, const UniformEntry& rhs) { return lhs.hash < rhs.hash; });
+		// two names sharing a hash would make one of them unreachable, so report it loudly
+		for (std::size_t i = 1; i < uniformTable.size(); i++)
+		{
+			if (uniformTable[i].hash == uniformTable[i - 1].hash)
+				std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION: " << uniformTable[i - 1].name << " and " << uniformTable[i].name << std::endl;
+		}
+	}
+	void addUniform(const std::string& name, GLint location)
+	{
+		uniformTable.push_back(UniformEntry{ hashUniformName(name.data(), name.size()), name, location });
+	}
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
@@ -9,6 +9,7 @@
 
 #include "shaders.h"
 #include "camera.h"
+#include "normal_matrix.h"
 
 #include <iostream>
 #include <filesystem>
@@ -251,6 +252,7 @@ int main()
 		glm::mat4 model = glm::mat4(1.0f);
 		model = glm::rotate(model, glm::radians(30.0f), glm::vec3(1.0, 1.0, 0.0));
 		lightingShader.setMat4("model", model);
+		lightingShader.setMat3("normalMatrix", normalMatrix(model));
 
 		// render the cube
 		glBindVertexArray(cubeVAO);
@@ -0,0 +1,107 @@
+#ifndef BLOCK_LAYOUT_H
+#define BLOCK_LAYOUT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <iostream>
+#include <algorithm>
+#include <type_traits>
+
+// Compile-time std140 rules for C++ mirrors of GLSL uniform blocks.
+//
+// Declare every member of a mirror struct with its GLSL base alignment,
+//
+//	struct PointLight
+//	{
+//		alignas(std140Alignment<glm::vec3>) glm::vec3 position;
+//		alignas(std140Alignment<float>) float constant;
+//	};
+//
+// and the compiler reproduces the GLSL packing: alignas on a member only moves its offset, so a
+// float right after a vec3 still lands in the vec3's fourth slot (offset 12) exactly like std140.
+// Nested structs take the alignment of their widest member, which std140 rounds up to a vec4.
+// mat3 and arrays of scalars are left out on purpose: their GLSL strides do not match C++.
+enum class BlockLayout
+{
+	STD140,
+};
+
+// base alignment of the basic GLSL types; anything else is treated as a nested mirror struct
+template <typename T>
+struct GlslType
+{
+	static_assert(std::is_class_v<T>, "type has no GLSL block equivalent");
+	static constexpr bool isStruct = true;
+	static constexpr std::size_t alignment = alignof(T); // widest member, thanks to the alignas
+};
+template <std::size_t Alignment>
+struct GlslBasicType
+{
+	static constexpr bool isStruct = false;
+	static constexpr std::size_t alignment = Alignment;
+};
+template <> struct GlslType<float> : GlslBasicType<4> {};
+template <> struct GlslType<int> : GlslBasicType<4> {};
+template <> struct GlslType<unsigned int> : GlslBasicType<4> {};
+template <> struct GlslType<glm::vec2> : GlslBasicType<8> {};
+template <> struct GlslType<glm::vec3> : GlslBasicType<16> {};
+template <> struct GlslType<glm::vec4> : GlslBasicType<16> {};
+template <> struct GlslType<glm::ivec4> : GlslBasicType<16> {};
+template <> struct GlslType<glm::mat4> : GlslBasicType<16> {};
+
+template <BlockLayout Layout, typename T>
+constexpr std::size_t glslAlignment()
+{
+	// std140 rounds the alignment of structs up to a vec4
+	if (GlslType<T>::isStruct)
+		return std::max<std::size_t>(GlslType<T>::alignment, 16);
+	return GlslType<T>::alignment;
+}
+template <typename T>
+inline constexpr std::size_t std140Alignment = glslAlignment<BlockLayout::STD140, T>();
+
+// the distance between two elements of a GLSL array of T, which sizeof(T) has to match
+template <BlockLayout Layout, typename T>
+constexpr std::size_t glslArrayStride()
+{
+	const std::size_t alignment = glslAlignment<Layout, T>();
+	return (sizeof(T) + alignment - 1) / alignment * alignment;
+}
+
+// Runtime cross-check of the C++ offsets against what the driver actually laid out
+// (glGetActiveUniformsiv with GL_UNIFORM_OFFSET). Members the program does not use are skipped.
+// ------------------------------------------------------------------------
+struct BlockMemberOffset
+{
+	std::string name;
+	std::size_t offset;
+};
+inline bool verifyBlockOffsets(GLuint program, const char* blockName, const std::vector<BlockMemberOffset>& members)
+{
+	std::vector<const GLchar*> names;
+	for (const BlockMemberOffset& member : members)
+		names.push_back(member.name.c_str());
+	std::vector<GLuint> indices(members.size(), GL_INVALID_INDEX);
+	glGetUniformIndices(program, (GLsizei)names.size(), names.data(), indices.data());
+
+	bool matches = true;
+	for (std::size_t i = 0; i < members.size(); i++)
+	{
+		if (indices[i] == GL_INVALID_INDEX)
+			continue;
+		GLint offset = -1;
+		glGetActiveUniformsiv(program, 1, &indices[i], GL_UNIFORM_OFFSET, &offset);
+		if (offset != (GLint)members[i].offset)
+		{
+			std::cout << "ERROR::BLOCK_LAYOUT::OFFSET_MISMATCH in " << blockName << ": " << members[i].name
+				<< " is at " << offset << " on the GPU but at " << members[i].offset << " in C++" << std::endl;
+			matches = false;
+		}
+	}
+	return matches;
+}
+#endif
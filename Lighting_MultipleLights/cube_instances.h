@@ -0,0 +1,116 @@
+#ifndef CUBE_INSTANCES_H
+#define CUBE_INSTANCES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "gl_state_cache.h"
+#include "normal_matrix.h"
+
+#include <cmath>
+#include <vector>
+#include <cstddef>
+
+// per-instance vertex attributes of the lit cubes, read by basic_lighting_obj.glslv when it is
+// built with INSTANCED (mat4 takes locations 3-6, mat3 takes 7-9)
+struct CubeInstance
+{
+	glm::mat4 model;
+	glm::mat3 normalMatrix;
+};
+const unsigned int CUBE_INSTANCE_MODEL_LOCATION = 3;
+const unsigned int CUBE_INSTANCE_NORMAL_MATRIX_LOCATION = 7;
+
+// The container scene at any size: the first ten cubes are the tutorial's cubePositions, the rest
+// fill a grid behind them, each row tilted a little further like the originals.
+// ------------------------------------------------------------------------
+inline std::vector<CubeInstance> generateCubeScene(const glm::vec3* classicPositions, std::size_t classicCount, std::size_t count)
+{
+	std::vector<CubeInstance> instances;
+	instances.reserve(count);
+	const std::size_t side = (std::size_t)std::ceil(std::cbrt((double)count));
+	for (std::size_t i = 0; i < count; i++)
+	{
+		glm::vec3 position;
+		if (i < classicCount)
+		{
+			position = classicPositions[i];
+		}
+		else
+		{
+			const std::size_t cell = i - classicCount;
+			position = glm::vec3(((float)(cell % side) - side * 0.5f) * 2.0f,
+				((float)(cell / side % side) - side * 0.5f) * 2.0f,
+				-20.0f - (float)(cell / (side * side)) * 2.0f);
+		}
+		glm::mat4 model = glm::mat4(1.0f);
+		model = glm::translate(model, position);
+		model = glm::rotate(model, glm::radians((i % 18) * 20.0f), glm::vec3(1.0f, 0.3f, 0.5f));
+		instances.push_back({ model, normalMatrix(model) });
+	}
+	return instances;
+}
+
+// One vertex buffer holding a CubeInstance per cube, advanced once per instance. attach() adds
+// the per-instance attributes to a VAO that already has the per-vertex ones.
+class CubeInstanceBuffer
+{
+public:
+	unsigned int VBO;
+	std::size_t count = 0;
+
+	CubeInstanceBuffer()
+	{
+		glGenBuffers(1, &VBO);
+	}
+	// the currently bound VAO picks up the instance attributes
+	// ------------------------------------------------------------------------
+	void attach() const
+	{
+		attach(VBO, 0);
+	}
+	// only the model matrix, for passes that need no normals like the shadow depth pass
+	// ------------------------------------------------------------------------
+	void attachModel() const
+	{
+		attachModel(VBO, 0);
+	}
+	// the same attributes read from instances packed at offset in any buffer, such as this frame's
+	// range of a FrameRingBuffer
+	// ------------------------------------------------------------------------
+	static void attach(GLuint buffer, GLintptr offset)
+	{
+		attachModel(buffer, offset);
+		for (unsigned int column = 0; column < 3; column++)
+		{
+			const unsigned int location = CUBE_INSTANCE_NORMAL_MATRIX_LOCATION + column;
+			glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(CubeInstance),
+				(void*)(offset + offsetof(CubeInstance, normalMatrix) + column * sizeof(glm::vec3)));
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, 1);
+		}
+	}
+	static void attachModel(GLuint buffer, GLintptr offset)
+	{
+		glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+		for (unsigned int column = 0; column < 4; column++)
+		{
+			const unsigned int location = CUBE_INSTANCE_MODEL_LOCATION + column;
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(CubeInstance),
+				(void*)(offset + offsetof(CubeInstance, model) + column * sizeof(glm::vec4)));
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, 1);
+		}
+	}
+	// replace the whole instance array: the old storage is orphaned (re-specified with no data) so a
+	// draw still reading it keeps its copy, and the new instances go into the fresh storage
+	// ------------------------------------------------------------------------
+	void upload(const std::vector<CubeInstance>& instances)
+	{
+		count = instances.size();
+		glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, count * sizeof(CubeInstance), NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(CubeInstance), instances.data());
+	}
+};
+#endif
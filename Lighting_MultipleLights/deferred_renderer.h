@@ -0,0 +1,194 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "gl_state_cache.h"
+
+#include <cstddef>
+#include <iostream>
+
+// texture units the lighting programs read the G-buffer from, after the forward path's 0-4
+const unsigned int GBUFFER_ALBEDO_SPECULAR_UNIT = 5;
+const unsigned int GBUFFER_NORMAL_UNIT = 6;
+const unsigned int GBUFFER_DEPTH_UNIT = 7;
+
+// Deferred shading next to the forward path. The geometry pass writes a compact G-buffer of
+// 12 bytes per pixel:
+//   - RGBA8: albedo, and the specular map in alpha (container2_specular is grey, one channel is enough),
+//   - RG16: the normal, octahedral encoded (see deferred_gbuffer.glslf),
+//   - DEPTH24_STENCIL8: depth, from which the lighting pass rebuilds the position, and a stencil
+//     bit for every pixel that received geometry.
+// The lighting pass then adds up the lights into a float accumulation target: directional and
+// spot light in one fullscreen triangle, limited to the covered pixels by the stencil bit, and
+// every point light as a box around its sphere of influence, one instanced draw for all of them.
+// The boxes draw their back faces with GL_GEQUAL against the scene depth, so only pixels whose
+// surface lies in front of the far side of the box are shaded and the camera may be inside one.
+// A pixel costs one G-buffer write however many cubes cover it, and then only the lights that
+// reach it, instead of every light for every covering fragment.
+// The lighting pass reads a copy of the depth so it never samples what it depth-tests against.
+class DeferredRenderer
+{
+public:
+	DeferredRenderer()
+	{
+		glGenFramebuffers(1, &gBuffer);
+		glGenFramebuffers(1, &lightBuffer);
+		glGenTextures(1, &albedoSpecular);
+		glGenTextures(1, &normal);
+		glGenTextures(1, &depthStencil);
+		glGenRenderbuffers(1, &lightColour);
+		glGenRenderbuffers(1, &lightDepthStencil);
+		glGenVertexArrays(1, &emptyVAO);
+	}
+	// free the GL objects, call before the context goes away
+	// ------------------------------------------------------------------------
+	void release()
+	{
+		glDeleteFramebuffers(1, &gBuffer);
+		glDeleteFramebuffers(1, &lightBuffer);
+		glState.deleteTextures(1, &albedoSpecular);
+		glState.deleteTextures(1, &normal);
+		glState.deleteTextures(1, &depthStencil);
+		glDeleteRenderbuffers(1, &lightColour);
+		glDeleteRenderbuffers(1, &lightDepthStencil);
+		glState.deleteVertexArrays(1, &emptyVAO);
+	}
+
+	// (re)allocate the targets for the framebuffer size, free when the size is unchanged
+	// ------------------------------------------------------------------------
+	void resize(int framebufferWidth, int framebufferHeight)
+	{
+		if (framebufferWidth == width && framebufferHeight == height)
+			return;
+		width = framebufferWidth;
+		height = framebufferHeight;
+		// allocate on one of our own units, the scene keeps its textures bound on the others
+		glState.activeTexture(GL_TEXTURE0 + GBUFFER_ALBEDO_SPECULAR_UNIT);
+		allocate(albedoSpecular, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+		allocate(normal, GL_RG16, GL_RG, GL_UNSIGNED_SHORT);
+		allocate(depthStencil, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+		glState.activeTexture(GL_TEXTURE0);
+		glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoSpecular, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normal, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthStencil, 0);
+		const GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, attachments);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::FRAMEBUFFER::GBUFFER_INCOMPLETE" << std::endl;
+
+		glBindRenderbuffer(GL_RENDERBUFFER, lightColour);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16F, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, lightDepthStencil);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, lightBuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, lightColour);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, lightDepthStencil);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::FRAMEBUFFER::LIGHT_BUFFER_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// geometry pass: draw the scene with deferred_gbuffer.glslf after this
+	// ------------------------------------------------------------------------
+	void beginGeometryPass() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		// mark every pixel the scene covers, the fullscreen lights skip the rest
+		glState.enable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS, 1, 0xFF);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	}
+	// lighting pass: the accumulation target starts as the current clear colour, the fullscreen
+	// pass replaces the covered pixels and the light volumes add onto them
+	// ------------------------------------------------------------------------
+	void beginLightingPass() const
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, lightBuffer);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, lightBuffer);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glState.activeTexture(GL_TEXTURE0 + GBUFFER_ALBEDO_SPECULAR_UNIT);
+		glState.bindTexture(GL_TEXTURE_2D, albedoSpecular);
+		glState.activeTexture(GL_TEXTURE0 + GBUFFER_NORMAL_UNIT);
+		glState.bindTexture(GL_TEXTURE_2D, normal);
+		glState.activeTexture(GL_TEXTURE0 + GBUFFER_DEPTH_UNIT);
+		glState.bindTexture(GL_TEXTURE_2D, depthStencil);
+		glState.activeTexture(GL_TEXTURE0);
+
+		glStencilFunc(GL_EQUAL, 1, 0xFF);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+		glState.depthMask(GL_FALSE);
+	}
+	// one triangle over the whole screen, for the program built without point lights
+	// ------------------------------------------------------------------------
+	void drawFullscreen() const
+	{
+		glState.disable(GL_DEPTH_TEST);
+		glState.bindVertexArray(emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glState.enable(GL_DEPTH_TEST);
+	}
+	// one box per point light, for the program built with point lights; the vertex shader makes
+	// the box from gl_VertexID so its winding is known
+	// ------------------------------------------------------------------------
+	void drawPointLightVolumes(std::size_t pointLights) const
+	{
+		glState.enable(GL_BLEND);
+		glState.blendFunc(GL_ONE, GL_ONE);
+		glState.enable(GL_CULL_FACE);
+		glState.cullFace(GL_FRONT);
+		glState.depthFunc(GL_GEQUAL);
+		// a far side beyond the far plane still has to light everything in front of it
+		glState.enable(GL_DEPTH_CLAMP);
+		glState.bindVertexArray(emptyVAO);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 36, (GLsizei)pointLights);
+		glState.disable(GL_DEPTH_CLAMP);
+		glState.depthFunc(GL_LESS);
+		glState.cullFace(GL_BACK);
+		glState.disable(GL_CULL_FACE);
+		glState.disable(GL_BLEND);
+	}
+	// back to the forward state; the light buffer stays bound so more forward geometry (the lamps)
+	// can be drawn against the scene depth before present()
+	// ------------------------------------------------------------------------
+	void endLightingPass() const
+	{
+		glState.depthMask(GL_TRUE);
+		glState.disable(GL_STENCIL_TEST);
+	}
+	// copy the lit image to the window
+	// ------------------------------------------------------------------------
+	void present() const
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, lightBuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	// bytes per pixel of the G-buffer, for the report
+	static constexpr std::size_t bytesPerPixel() { return 4 + 4 + 4; }
+
+private:
+	int width = 0, height = 0;
+	unsigned int gBuffer, lightBuffer;
+	unsigned int albedoSpecular, normal, depthStencil;
+	unsigned int lightColour, lightDepthStencil;
+	unsigned int emptyVAO; // core profile wants a VAO bound even without attributes
+
+	void allocate(unsigned int texture, GLint internalFormat, GLenum format, GLenum type) const
+	{
+		glState.bindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+		// read with texelFetch only, but without mipmaps the default filter leaves the texture incomplete
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glState.bindTexture(GL_TEXTURE_2D, 0);
+	}
+};
+#endif
@@ -0,0 +1,53 @@
+#ifndef FRAME_CONSTANTS_H
+#define FRAME_CONSTANTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "shaders.h"
+#include "frame_ring_buffer.h"
+
+#include <cstddef>
+
+// C++ mirror of the std140 block every program may declare:
+//
+//	layout (std140) uniform FrameConstants
+//	{
+//		mat4 projection;
+//		mat4 view;
+//		vec3 viewPos;
+//	};
+struct FrameConstants
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 viewPos; // vec3 in GLSL, std140 pads it to 16 bytes anyway
+};
+static_assert(offsetof(FrameConstants, projection) == 0, "std140 offset mismatch");
+static_assert(offsetof(FrameConstants, view) == 64, "std140 offset mismatch");
+static_assert(offsetof(FrameConstants, viewPos) == 128, "std140 offset mismatch");
+static_assert(sizeof(FrameConstants) == 144, "std140 size mismatch");
+
+// The camera changes every frame, so the block lives in the FrameRingBuffer: update() copies it into
+// this frame's region and binds that range at FRAME_CONSTANTS_BINDING. Shader attaches every program
+// that declares the block to that binding point after link, so the camera is uploaded once per frame
+// no matter how many programs read it.
+class FrameConstantsBuffer
+{
+public:
+	explicit FrameConstantsBuffer(FrameRingBuffer& ring) : ring(ring) {}
+
+	// call once per frame, after ring.beginFrame() and before the first draw
+	// ------------------------------------------------------------------------
+	void update(const glm::mat4& projection, const glm::mat4& view, const glm::vec3& viewPos)
+	{
+		const FrameConstants constants{ projection, view, glm::vec4(viewPos, 1.0f) };
+		const FrameRingBuffer::Allocation allocation = ring.pushUniform(constants);
+		// if the ring could not take it, last frame's range stays bound: one frame with the old camera
+		if (allocation.valid())
+			ring.bindUniformBlock(FRAME_CONSTANTS_BINDING, allocation);
+	}
+
+private:
+	FrameRingBuffer& ring;
+};
+#endif
@@ -0,0 +1,195 @@
+#ifndef FRAME_RING_BUFFER_H
+#define FRAME_RING_BUFFER_H
+
+#include <glad/glad.h>
+#include "gl_state_cache.h"
+#include "gl_extensions.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+// One buffer for the data that is written anew every frame, split into REGIONS equal regions used
+// round robin: the CPU fills one while the GPU may still read the two before it. endFrame() puts a
+// fence behind the frame's commands and beginFrame() waits on it before the region is written
+// again, so no write ever lands on data in flight and the driver never has to stall or copy.
+// With GL_ARB_buffer_storage the buffer is mapped once, persistent and coherent, and push() is a
+// memcpy. Without it every push() maps its range unsynchronised instead, safe for the same reason.
+// Allocations are aligned and only live until the end of the frame.
+class FrameRingBuffer
+{
+public:
+	static constexpr unsigned int REGIONS = 3;
+
+	// a range of this frame's region, offset is -1 when the region had no room left or the range
+	// could not be mapped
+	struct Allocation
+	{
+		GLintptr offset = -1;
+		GLsizeiptr size = 0;
+
+		bool valid() const { return offset >= 0; }
+	};
+	// since the last resetStats(), for the per-frame report
+	struct Stats
+	{
+		unsigned int frames = 0;
+		unsigned int stalls = 0;      // beginFrame() calls that found the GPU still reading the region
+		double stallTime = 0.0;       // seconds spent waiting in them
+		GLsizeiptr peakBytes = 0;     // most of a region one frame used
+		unsigned int overflows = 0;   // push() calls that did not fit
+		unsigned int mapFailures = 0; // push() calls whose glMapBufferRange returned NULL
+	};
+
+	explicit FrameRingBuffer(GLsizeiptr regionSize) : regionSize(regionSize)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		uniformAlignment = std::max<GLsizeiptr>(alignment, 16);
+		persistent = GLAD_GL_ARB_buffer_storage != 0;
+
+		glGenBuffers(1, &buffer);
+		glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		if (persistent)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, REGIONS * regionSize, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, REGIONS * regionSize, flags);
+			if (mapped == NULL)
+			{
+				std::cout << "ERROR::FRAME_RING_BUFFER::PERSISTENT_MAP_FAILED" << std::endl;
+				persistent = false;
+				glState.deleteBuffers(1, &buffer);
+				glGenBuffers(1, &buffer);
+				glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			}
+		}
+		if (!persistent)
+			glBufferData(GL_COPY_WRITE_BUFFER, REGIONS * regionSize, NULL, GL_STREAM_DRAW);
+		glState.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	// free the GL objects, call before the context goes away
+	// ------------------------------------------------------------------------
+	void release()
+	{
+		for (GLsync& fence : fences)
+		{
+			if (fence != NULL)
+				glDeleteSync(fence);
+			fence = NULL;
+		}
+		if (mapped != NULL)
+		{
+			glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glState.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			mapped = NULL;
+		}
+		glState.deleteBuffers(1, &buffer);
+	}
+
+	// move on to the next region, waiting for the GPU if it still reads it; call before the first push()
+	// ------------------------------------------------------------------------
+	void beginFrame()
+	{
+		region = (region + 1) % REGIONS;
+		head = region * regionSize;
+		stats_.frames++;
+		GLsync& fence = fences[region];
+		if (fence == NULL)
+			return;
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			// the CPU is REGIONS frames ahead: flush so the fence can signal and wait for it
+			const auto stallStart = std::chrono::steady_clock::now();
+			do
+				status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			while (status == GL_TIMEOUT_EXPIRED);
+			stats_.stalls++;
+			stats_.stallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - stallStart).count();
+		}
+		if (status == GL_WAIT_FAILED)
+			std::cout << "ERROR::FRAME_RING_BUFFER::WAIT_FAILED" << std::endl;
+		glDeleteSync(fence);
+		fence = NULL;
+	}
+	// fence the region behind everything drawn from it; call after the frame's last draw
+	// ------------------------------------------------------------------------
+	void endFrame()
+	{
+		stats_.peakBytes = std::max(stats_.peakBytes, head - region * regionSize);
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// copy size bytes into this frame's region at the next multiple of alignment (a power of two)
+	// ------------------------------------------------------------------------
+	Allocation push(const void* data, GLsizeiptr size, GLsizeiptr alignment)
+	{
+		const GLintptr offset = (head + alignment - 1) & ~(alignment - 1);
+		if (offset + size > (region + 1) * regionSize)
+		{
+			stats_.overflows++;
+			return Allocation();
+		}
+		if (size > 0)
+		{
+			if (persistent)
+			{
+				std::memcpy(mapped + offset, data, size);
+			}
+			else
+			{
+				glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+				void* range = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+					GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+				if (range == NULL)
+				{
+					// nothing is mapped, so there is nothing to unmap; the caller falls back as on overflow
+					glState.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+					stats_.mapFailures++;
+					return Allocation();
+				}
+				std::memcpy(range, data, size);
+				glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+				glState.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			}
+		}
+		head = offset + size;
+		Allocation allocation;
+		allocation.offset = offset;
+		allocation.size = size;
+		return allocation;
+	}
+	// a std140 block, aligned for glBindBufferRange on GL_UNIFORM_BUFFER
+	template<typename Block>
+	Allocation pushUniform(const Block& block)
+	{
+		return push(&block, sizeof(Block), uniformAlignment);
+	}
+	void bindUniformBlock(GLuint binding, const Allocation& allocation) const
+	{
+		glState.bindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, allocation.offset, allocation.size);
+	}
+
+	GLuint id() const { return buffer; }
+	GLsizeiptr capacity() const { return regionSize; }
+	bool persistentlyMapped() const { return persistent; }
+	const Stats& stats() const { return stats_; }
+	void resetStats() { stats_ = Stats(); }
+
+private:
+	GLuint buffer = 0;
+	GLsizeiptr regionSize;
+	GLsizeiptr uniformAlignment = 256;
+	bool persistent = false;
+	unsigned char* mapped = NULL;
+	GLsync fences[REGIONS] = {};
+	// region is where this frame writes, starting at the last one so the first beginFrame() takes region 0
+	unsigned int region = REGIONS - 1;
+	GLintptr head = 0;
+	Stats stats_;
+};
+#endif
@@ -0,0 +1,97 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// glad.c is generated for the plain GL 3.3 core profile, so anything newer is loaded here by hand.
+// Every entry point below is optional: it stays NULL unless the driver exposes it, check the
+// matching GLAD_GL_* flag before calling it. Naming follows glad so call sites read like core GL.
+
+// GL_ARB_get_program_binary (core in 4.1)
+// ------------------------------------------------------------------------
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#define GL_PROGRAM_BINARY_FORMATS 0x87FF
+#endif
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+inline int GLAD_GL_ARB_get_program_binary = 0;
+inline PFNGLGETPROGRAMBINARYPROC glad_glGetProgramBinary = NULL;
+inline PFNGLPROGRAMBINARYPROC glad_glProgramBinary = NULL;
+inline PFNGLPROGRAMPARAMETERIPROC glad_glProgramParameteri = NULL;
+#define glGetProgramBinary glad_glGetProgramBinary
+#define glProgramBinary glad_glProgramBinary
+#define glProgramParameteri glad_glProgramParameteri
+
+// GL_KHR_parallel_shader_compile, or its GL_ARB_parallel_shader_compile twin
+// ------------------------------------------------------------------------
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+inline int GLAD_GL_KHR_parallel_shader_compile = 0;
+inline PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR = NULL;
+#define glMaxShaderCompilerThreadsKHR glad_glMaxShaderCompilerThreadsKHR
+
+// GL_ARB_buffer_storage (core in 4.4)
+// ------------------------------------------------------------------------
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+inline int GLAD_GL_ARB_buffer_storage = 0;
+inline PFNGLBUFFERSTORAGEPROC glad_glBufferStorage = NULL;
+#define glBufferStorage glad_glBufferStorage
+
+// utility queries
+// ------------------------------------------------------------------------
+inline bool hasGLExtension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+		if (extension != NULL && std::strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+inline bool hasGLVersion(int major, int minor)
+{
+	GLint contextMajor = 0, contextMinor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+	glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+	return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+// call once right after gladLoadGLLoader, with the same loader
+// ------------------------------------------------------------------------
+inline void loadGLExtensions(GLADloadproc load)
+{
+	if (hasGLVersion(4, 1) || hasGLExtension("GL_ARB_get_program_binary"))
+	{
+		glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+		glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+		glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+		GLAD_GL_ARB_get_program_binary = glad_glGetProgramBinary != NULL && glad_glProgramBinary != NULL && glad_glProgramParameteri != NULL;
+	}
+	if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+		glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+	else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+		glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+	GLAD_GL_KHR_parallel_shader_compile = glad_glMaxShaderCompilerThreadsKHR != NULL;
+	if (hasGLVersion(4, 4) || hasGLExtension("GL_ARB_buffer_storage"))
+		glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+	GLAD_GL_ARB_buffer_storage = glad_glBufferStorage != NULL;
+}
+#endif
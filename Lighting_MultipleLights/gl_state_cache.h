@@ -0,0 +1,323 @@
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <cstddef>
+
+// Mirror of the binds and fixed-function switches the chapter changes per frame: the current
+// program and VAO, the active unit and each unit's textures, the non-indexed buffer bindings and
+// depth, blend, cull and the enable/disable caps. Every call goes through glState and is dropped
+// when GL already holds that value. That only works if nothing binds behind its back, so every
+// bind and delete of these objects in the chapter goes through it, deletes included since GL
+// reuses names. Everything starts unknown and the first call of each kind always reaches GL.
+// verify() reads it all back with glGet* and reports what differs, for debug builds.
+class GLStateCache
+{
+public:
+	static constexpr unsigned int TEXTURE_UNITS = 16;
+
+	// calls that reached GL and calls dropped as redundant since the last resetStats()
+	struct Stats
+	{
+		unsigned int issued = 0;
+		unsigned int elided = 0;
+	};
+
+	GLStateCache()
+	{
+		invalidate();
+	}
+
+	// programs and vertex arrays
+	// ------------------------------------------------------------------------
+	void useProgram(GLuint program)
+	{
+		if (change(currentProgram, program))
+			glUseProgram(program);
+	}
+	void bindVertexArray(GLuint vao)
+	{
+		if (change(currentVao, vao))
+			glBindVertexArray(vao);
+	}
+	// textures, per unit and target
+	// ------------------------------------------------------------------------
+	void activeTexture(GLenum unit)
+	{
+		if (change(currentUnit, unit - GL_TEXTURE0))
+			glActiveTexture(unit);
+	}
+	void bindTexture(GLenum target, GLuint texture)
+	{
+		if (currentUnit >= TEXTURE_UNITS)
+		{
+			// some unit we do not know, or do not track, now holds texture
+			for (unsigned int unit = 0; unit < TEXTURE_UNITS; unit++)
+				if (GLuint* slot = textureSlot(unit, target))
+					*slot = UNKNOWN;
+			stats_.issued++;
+			glBindTexture(target, texture);
+			return;
+		}
+		GLuint* slot = textureSlot(currentUnit, target);
+		if (slot == nullptr)
+		{
+			stats_.issued++;
+			glBindTexture(target, texture);
+			return;
+		}
+		if (change(*slot, texture))
+			glBindTexture(target, texture);
+	}
+	// buffers; GL_ELEMENT_ARRAY_BUFFER belongs to the VAO and always goes through
+	// ------------------------------------------------------------------------
+	void bindBuffer(GLenum target, GLuint buffer)
+	{
+		GLuint* slot = bufferSlot(target);
+		if (slot == nullptr)
+		{
+			stats_.issued++;
+			glBindBuffer(target, buffer);
+			return;
+		}
+		if (change(*slot, buffer))
+			glBindBuffer(target, buffer);
+	}
+	// indexed bindings are not cached, but they also bind the generic target
+	void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+	{
+		stats_.issued++;
+		glBindBufferBase(target, index, buffer);
+		if (GLuint* slot = bufferSlot(target))
+			*slot = buffer;
+	}
+	void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+	{
+		stats_.issued++;
+		glBindBufferRange(target, index, buffer, offset, size);
+		if (GLuint* slot = bufferSlot(target))
+			*slot = buffer;
+	}
+	// fixed function switches
+	// ------------------------------------------------------------------------
+	void enable(GLenum capability)
+	{
+		setCapability(capability, true);
+	}
+	void disable(GLenum capability)
+	{
+		setCapability(capability, false);
+	}
+	void depthFunc(GLenum func)
+	{
+		if (change(currentDepthFunc, func))
+			glDepthFunc(func);
+	}
+	void depthMask(GLboolean flag)
+	{
+		if (change(currentDepthMask, (GLuint)flag))
+			glDepthMask(flag);
+	}
+	void blendFunc(GLenum sfactor, GLenum dfactor)
+	{
+		if (currentBlendSrc == sfactor && currentBlendDst == dfactor)
+		{
+			stats_.elided++;
+			return;
+		}
+		stats_.issued++;
+		currentBlendSrc = sfactor;
+		currentBlendDst = dfactor;
+		glBlendFunc(sfactor, dfactor);
+	}
+	void cullFace(GLenum mode)
+	{
+		if (change(currentCullFace, mode))
+			glCullFace(mode);
+	}
+	// deletes: GL unbinds a deleted object and may hand its name out again, the cache forgets it too
+	// ------------------------------------------------------------------------
+	void deleteProgram(GLuint program)
+	{
+		glDeleteProgram(program);
+		if (currentProgram == program)
+			currentProgram = UNKNOWN;
+	}
+	void deleteVertexArrays(GLsizei n, const GLuint* vaos)
+	{
+		glDeleteVertexArrays(n, vaos);
+		for (GLsizei i = 0; i < n; i++)
+			if (vaos[i] != 0 && currentVao == vaos[i])
+				currentVao = 0;
+	}
+	void deleteTextures(GLsizei n, const GLuint* textures)
+	{
+		glDeleteTextures(n, textures);
+		for (GLsizei i = 0; i < n; i++)
+			for (unsigned int unit = 0; unit < TEXTURE_UNITS; unit++)
+				for (GLuint& slot : unitTextures[unit])
+					if (textures[i] != 0 && slot == textures[i])
+						slot = 0;
+	}
+	void deleteBuffers(GLsizei n, const GLuint* buffers)
+	{
+		glDeleteBuffers(n, buffers);
+		for (GLsizei i = 0; i < n; i++)
+			for (GLuint& slot : bufferBindings)
+				if (buffers[i] != 0 && slot == buffers[i])
+					slot = 0;
+	}
+
+	// forget everything, for code that had to go around the cache
+	void invalidate()
+	{
+		currentProgram = currentVao = currentUnit = UNKNOWN;
+		for (auto& unit : unitTextures)
+			for (GLuint& slot : unit)
+				slot = UNKNOWN;
+		for (GLuint& slot : bufferBindings)
+			slot = UNKNOWN;
+		for (GLuint& slot : capabilities)
+			slot = UNKNOWN;
+		currentDepthFunc = currentDepthMask = currentBlendSrc = currentBlendDst = currentCullFace = UNKNOWN;
+	}
+	const Stats& stats() const { return stats_; }
+	void resetStats() { stats_ = Stats(); }
+
+	// read every known value back from GL and print the ones that differ; returns the mismatch count.
+	// Costs a round trip per value, meant for debug builds once a frame.
+	// ------------------------------------------------------------------------
+	unsigned int verify() const
+	{
+		unsigned int mismatches = 0;
+		auto check = [&mismatches](const char* what, GLuint cached, GLint actual)
+		{
+			if (cached == UNKNOWN || cached == (GLuint)actual)
+				return;
+			std::cout << "ERROR::GL_STATE_CACHE::MISMATCH " << what << " cached " << cached << " actual " << actual << std::endl;
+			mismatches++;
+		};
+		check("program", currentProgram, getInteger(GL_CURRENT_PROGRAM));
+		check("vertex array", currentVao, getInteger(GL_VERTEX_ARRAY_BINDING));
+		const GLint activeUnit = getInteger(GL_ACTIVE_TEXTURE) - GL_TEXTURE0;
+		check("active texture unit", currentUnit, activeUnit);
+		for (unsigned int unit = 0; unit < TEXTURE_UNITS; unit++)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			for (std::size_t target = 0; target < TEXTURE_TARGET_COUNT; target++)
+				check(TEXTURE_TARGETS[target].name, unitTextures[unit][target], getInteger(TEXTURE_TARGETS[target].binding));
+		}
+		glActiveTexture(GL_TEXTURE0 + activeUnit);
+		for (std::size_t target = 0; target < BUFFER_TARGET_COUNT; target++)
+			check(BUFFER_TARGETS[target].name, bufferBindings[target], getInteger(BUFFER_TARGETS[target].binding));
+		for (std::size_t capability = 0; capability < CAPABILITY_COUNT; capability++)
+			check(CAPABILITIES[capability].name, capabilities[capability], glIsEnabled(CAPABILITIES[capability].capability));
+		check("depth func", currentDepthFunc, getInteger(GL_DEPTH_FUNC));
+		check("depth mask", currentDepthMask, getInteger(GL_DEPTH_WRITEMASK));
+		check("blend src", currentBlendSrc, getInteger(GL_BLEND_SRC_RGB));
+		check("blend dst", currentBlendDst, getInteger(GL_BLEND_DST_RGB));
+		check("cull face", currentCullFace, getInteger(GL_CULL_FACE_MODE));
+		return mismatches;
+	}
+
+private:
+	static constexpr GLuint UNKNOWN = ~0u;
+
+	struct Target
+	{
+		GLenum target;
+		GLenum binding; // the glGet name of its binding
+		const char* name;
+	};
+	static constexpr std::size_t TEXTURE_TARGET_COUNT = 4;
+	static constexpr Target TEXTURE_TARGETS[TEXTURE_TARGET_COUNT] = {
+		{ GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D, "texture 2D" },
+		{ GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BINDING_2D_ARRAY, "texture 2D array" },
+		{ GL_TEXTURE_BUFFER, GL_TEXTURE_BINDING_BUFFER, "texture buffer" },
+		{ GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BINDING_CUBE_MAP, "texture cube map" },
+	};
+	static constexpr std::size_t BUFFER_TARGET_COUNT = 6;
+	static constexpr Target BUFFER_TARGETS[BUFFER_TARGET_COUNT] = {
+		{ GL_ARRAY_BUFFER, GL_ARRAY_BUFFER_BINDING, "array buffer" },
+		{ GL_UNIFORM_BUFFER, GL_UNIFORM_BUFFER_BINDING, "uniform buffer" },
+		{ GL_TEXTURE_BUFFER, GL_TEXTURE_BUFFER, "texture buffer object" }, // GL 3.3 has no separate binding name
+		{ GL_COPY_READ_BUFFER, GL_COPY_READ_BUFFER, "copy read buffer" },
+		{ GL_COPY_WRITE_BUFFER, GL_COPY_WRITE_BUFFER, "copy write buffer" },
+		{ GL_PIXEL_PACK_BUFFER, GL_PIXEL_PACK_BUFFER_BINDING, "pixel pack buffer" },
+	};
+	struct Capability
+	{
+		GLenum capability;
+		const char* name;
+	};
+	static constexpr std::size_t CAPABILITY_COUNT = 7;
+	static constexpr Capability CAPABILITIES[CAPABILITY_COUNT] = {
+		{ GL_DEPTH_TEST, "depth test" },
+		{ GL_BLEND, "blend" },
+		{ GL_CULL_FACE, "cull face" },
+		{ GL_STENCIL_TEST, "stencil test" },
+		{ GL_SCISSOR_TEST, "scissor test" },
+		{ GL_POLYGON_OFFSET_FILL, "polygon offset fill" },
+		{ GL_DEPTH_CLAMP, "depth clamp" },
+	};
+
+	GLuint currentProgram, currentVao, currentUnit;
+	GLuint unitTextures[TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+	GLuint bufferBindings[BUFFER_TARGET_COUNT];
+	GLuint capabilities[CAPABILITY_COUNT];
+	GLuint currentDepthFunc, currentDepthMask, currentBlendSrc, currentBlendDst, currentCullFace;
+	Stats stats_;
+
+	// store value and report whether GL has to hear about it
+	bool change(GLuint& cached, GLuint value)
+	{
+		if (cached == value)
+		{
+			stats_.elided++;
+			return false;
+		}
+		cached = value;
+		stats_.issued++;
+		return true;
+	}
+	GLuint* textureSlot(GLuint unit, GLenum target)
+	{
+		for (std::size_t i = 0; i < TEXTURE_TARGET_COUNT; i++)
+			if (TEXTURE_TARGETS[i].target == target)
+				return &unitTextures[unit][i];
+		return nullptr;
+	}
+	GLuint* bufferSlot(GLenum target)
+	{
+		for (std::size_t i = 0; i < BUFFER_TARGET_COUNT; i++)
+			if (BUFFER_TARGETS[i].target == target)
+				return &bufferBindings[i];
+		return nullptr;
+	}
+	void setCapability(GLenum capability, bool on)
+	{
+		for (std::size_t i = 0; i < CAPABILITY_COUNT; i++)
+		{
+			if (CAPABILITIES[i].capability != capability)
+				continue;
+			if (change(capabilities[i], on ? 1u : 0u))
+				on ? glEnable(capability) : glDisable(capability);
+			return;
+		}
+		// not tracked, always goes through
+		stats_.issued++;
+		on ? glEnable(capability) : glDisable(capability);
+	}
+	static GLint getInteger(GLenum name)
+	{
+		GLint value = 0;
+		glGetIntegerv(name, &value);
+		return value;
+	}
+};
+
+// the one context's cache, every bind in the chapter goes through it
+inline GLStateCache glState;
+#endif
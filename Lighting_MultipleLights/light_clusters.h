@@ -0,0 +1,296 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "gl_state_cache.h"
+#include "lights.h"
+#include "light_manager.h"
+#include "worker_pool.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <barrier>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define LIGHT_CLUSTERS_SSE
+#endif
+
+// a point light dimmer than this (a couple of 8-bit steps) is treated as out of reach
+const float POINT_LIGHT_CUTOFF = 5.0f / 256.0f;
+
+// Distance at which the attenuation 1 / (constant + linear*d + quadratic*d^2) has brought the
+// light's brightest channel below POINT_LIGHT_CUTOFF. 0 for lights that never reach it (switched
+// off ones), infinity for lights that never fall off.
+// ------------------------------------------------------------------------
+inline float pointLightRadius(const PointLight& light)
+{
+	const glm::vec3 colour = light.ambient + light.diffuse + light.specular;
+	const float brightest = std::max(colour.r, std::max(colour.g, colour.b));
+	// the positive root of quadratic*d^2 + linear*d + (constant - brightest / cutoff) = 0
+	const float c = light.constant - brightest / POINT_LIGHT_CUTOFF;
+	if (c >= 0.0f)
+		return 0.0f;
+	if (light.quadratic > 0.0f)
+		return (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+	if (light.linear > 0.0f)
+		return -c / light.linear;
+	return std::numeric_limits<float>::infinity();
+}
+
+// Clustered forward shading. The view frustum is cut into CLUSTER_GRID_X x CLUSTER_GRID_Y tiles on
+// screen and CLUSTER_GRID_Z exponentially spaced depth slices, and every cluster gets the list of
+// point lights whose sphere of influence touches it. The CLUSTERED fragment shader finds its
+// cluster from gl_FragCoord and view depth and only walks that list, so a fragment pays for the
+// lights near it instead of every light in the LightManager.
+// build() assigns the lights on the CPU every frame, split over the threads of a WorkerPool:
+//   1. each worker takes a run of lights, moves them to view space, bounds their spheres in
+//      cluster coordinates (four lights at a time with SSE) and counts the lights per cluster,
+//   2. once all workers are done the counts become offsets into one compact index list,
+//   3. each worker writes its light indices into the places reserved for it.
+// The result goes to two texture buffers: an (offset, count) pair per cluster and the index list.
+class LightClusters
+{
+public:
+	static constexpr unsigned int CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+	// lights a worker thread should have before another one is worth starting
+	static constexpr std::size_t LIGHTS_PER_THREAD = 256;
+
+	// what the last build() produced, for the per-frame report
+	struct BuildStats
+	{
+		std::size_t lights = 0;
+		std::size_t visibleLights = 0; // touching at least one cluster
+		std::size_t indices = 0;
+		unsigned int threads = 0;
+	};
+
+	explicit LightClusters(WorkerPool& pool) : pool(pool)
+	{
+		glGenBuffers(1, &clusterBuffer);
+		glGenBuffers(1, &indexBuffer);
+		glGenTextures(1, &clusterTexture);
+		glGenTextures(1, &indexTexture);
+		glState.bindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, CLUSTER_COUNT * 2 * sizeof(std::uint32_t), NULL, GL_STREAM_DRAW);
+		glState.bindBuffer(GL_TEXTURE_BUFFER, indexBuffer); // a buffer name only becomes an object once bound
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(std::uint32_t), NULL, GL_STREAM_DRAW);
+		glState.bindBuffer(GL_TEXTURE_BUFFER, 0);
+		glState.bindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusterBuffer);
+		glState.bindTexture(GL_TEXTURE_BUFFER, indexTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+		glState.bindTexture(GL_TEXTURE_BUFFER, 0);
+		clusterTable.resize(CLUSTER_COUNT * 2);
+	}
+	// free the GL objects, call before the context goes away
+	// ------------------------------------------------------------------------
+	void release()
+	{
+		glState.deleteTextures(1, &clusterTexture);
+		glState.deleteTextures(1, &indexTexture);
+		glState.deleteBuffers(1, &clusterBuffer);
+		glState.deleteBuffers(1, &indexBuffer);
+	}
+
+	// assign every point light to the clusters it reaches and upload the lists; the projection is
+	// given by its parameters since the depth slices depend on the near and far plane
+	// ------------------------------------------------------------------------
+	BuildStats build(const LightManager& lights, const glm::mat4& view, float fovY, float aspect, float zNear, float zFar)
+	{
+		const std::size_t count = lights.pointLightCount();
+		const std::size_t padded = (count + 3) & ~std::size_t(3);
+		nearPlane = zNear;
+		farPlane = zFar;
+		// slice = log(depth / near) / log(far / near) * CLUSTER_GRID_Z, folded into one multiply-add
+		depthScale = CLUSTER_GRID_Z / std::log(zFar / zNear);
+		depthBias = -std::log(zNear) * depthScale;
+		// view space x / depth to tile column: ndc = x / (depth * tan(fovX / 2)), tile = (ndc * 0.5 + 0.5) * grid
+		const float tanHalfY = std::tan(fovY * 0.5f);
+		tileScaleX = 0.5f * CLUSTER_GRID_X / (tanHalfY * aspect);
+		tileScaleY = 0.5f * CLUSTER_GRID_Y / tanHalfY;
+
+		for (std::vector<float>* column : { &centreX, &centreY, &depth, &radius, &tileMinX, &tileMaxX, &tileMinY, &tileMaxY })
+			column->resize(padded);
+		// the padding lanes go through the SIMD bounds but are dropped as radius 0
+		for (std::size_t i = count; i < padded; i++)
+			centreX[i] = centreY[i] = depth[i] = radius[i] = 0.0f;
+
+		const unsigned int threadCount = (unsigned int)std::clamp<std::size_t>(count / LIGHTS_PER_THREAD, 1, pool.size());
+		// runs of a multiple of four lights so no SSE group straddles two workers
+		const std::size_t run = ((count + threadCount - 1) / threadCount + 3) & ~std::size_t(3);
+		workers.resize(threadCount);
+
+		auto computeOffsets = [this]() noexcept
+		{
+			std::uint32_t offset = 0;
+			for (unsigned int cluster = 0; cluster < CLUSTER_COUNT; cluster++)
+			{
+				clusterTable[cluster * 2] = offset;
+				for (Worker& worker : workers)
+				{
+					const std::uint32_t lightsHere = worker.counts[cluster];
+					worker.counts[cluster] = offset; // from now on the worker's write cursor
+					offset += lightsHere;
+				}
+				clusterTable[cluster * 2 + 1] = offset - clusterTable[cluster * 2];
+			}
+			lightIndices.resize(offset);
+		};
+		std::barrier sync((std::ptrdiff_t)threadCount, computeOffsets);
+		auto work = [&](unsigned int t)
+		{
+			const std::size_t begin = std::min(count, t * run);
+			const std::size_t end = std::min(count, begin + run);
+			Worker& worker = workers[t];
+			worker.counts.assign(CLUSTER_COUNT, 0);
+			worker.ranges.clear();
+			for (std::size_t i = begin; i < end; i++)
+			{
+				const PointLight& light = lights.pointLight(i);
+				const glm::vec4 centre = view * glm::vec4(light.position, 1.0f);
+				centreX[i] = centre.x;
+				centreY[i] = centre.y;
+				depth[i] = -centre.z;
+				radius[i] = pointLightRadius(light);
+			}
+			if (begin < end)
+				tileBounds(begin, std::min(padded, (end + 3) & ~std::size_t(3)));
+			assignRanges(begin, end, worker);
+			sync.arrive_and_wait();
+			writeIndices(worker);
+		};
+		pool.run(threadCount, work);
+
+		glState.bindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, clusterTable.size() * sizeof(std::uint32_t), clusterTable.data(), GL_STREAM_DRAW);
+		// the whole list changes every frame, orphan the old storage instead of waiting on it
+		glState.bindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, lightIndices.size() * sizeof(std::uint32_t), lightIndices.data(), GL_STREAM_DRAW);
+		glState.bindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		BuildStats stats;
+		stats.lights = count;
+		for (const Worker& worker : workers)
+			stats.visibleLights += worker.ranges.size();
+		stats.indices = lightIndices.size();
+		stats.threads = threadCount;
+		return stats;
+	}
+
+	// bind the lists for "uniform usamplerBuffer clusterRanges" and "clusterLightIndices"
+	// ------------------------------------------------------------------------
+	void bind(unsigned int rangesUnit, unsigned int indicesUnit) const
+	{
+		glState.activeTexture(GL_TEXTURE0 + rangesUnit);
+		glState.bindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+		glState.activeTexture(GL_TEXTURE0 + indicesUnit);
+		glState.bindTexture(GL_TEXTURE_BUFFER, indexTexture);
+		glState.activeTexture(GL_TEXTURE0);
+	}
+	// for "uniform vec2 clusterDepthScaleBias": depth slice = log(view depth) * x + y
+	glm::vec2 depthScaleBias() const { return glm::vec2(depthScale, depthBias); }
+
+private:
+	// the clusters one light covers, inclusive on both ends
+	struct ClusterRange
+	{
+		std::uint32_t light;
+		std::uint8_t minX, maxX, minY, maxY, minZ, maxZ;
+	};
+	struct Worker
+	{
+		std::vector<std::uint32_t> counts;
+		std::vector<ClusterRange> ranges;
+	};
+
+	unsigned int clusterBuffer, indexBuffer;
+	unsigned int clusterTexture, indexTexture;
+	std::vector<std::uint32_t> clusterTable; // offset, count per cluster
+	std::vector<std::uint32_t> lightIndices;
+	std::vector<Worker> workers;
+	WorkerPool& pool;
+	float nearPlane = 0.1f, farPlane = 100.0f;
+	float depthScale = 0.0f, depthBias = 0.0f;
+	float tileScaleX = 0.0f, tileScaleY = 0.0f;
+	// the lights in view space as structure of arrays, and the screen tiles each one spans
+	std::vector<float> centreX, centreY, depth, radius;
+	std::vector<float> tileMinX, tileMaxX, tileMinY, tileMaxY;
+
+	// Screen tile range of each light's bounding box between its clipped near and far depth. x / depth
+	// is monotonic in both, so the extremes are at the box corners. [begin, end) is a multiple of four.
+	// ------------------------------------------------------------------------
+	void tileBounds(std::size_t begin, std::size_t end)
+	{
+		const float offsetX = 0.5f * CLUSTER_GRID_X, offsetY = 0.5f * CLUSTER_GRID_Y;
+#ifdef LIGHT_CLUSTERS_SSE
+		const __m128 nearV = _mm_set1_ps(nearPlane), farV = _mm_set1_ps(farPlane), one = _mm_set1_ps(1.0f);
+		const __m128 scaleX = _mm_set1_ps(tileScaleX), scaleY = _mm_set1_ps(tileScaleY);
+		const __m128 originX = _mm_set1_ps(offsetX), originY = _mm_set1_ps(offsetY);
+		for (std::size_t i = begin; i < end; i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(&centreX[i]), y = _mm_loadu_ps(&centreY[i]);
+			const __m128 d = _mm_loadu_ps(&depth[i]), r = _mm_loadu_ps(&radius[i]);
+			const __m128 invNear = _mm_div_ps(one, _mm_max_ps(_mm_sub_ps(d, r), nearV));
+			const __m128 invFar = _mm_div_ps(one, _mm_min_ps(_mm_add_ps(d, r), farV));
+			const __m128 left = _mm_sub_ps(x, r), right = _mm_add_ps(x, r);
+			const __m128 bottom = _mm_sub_ps(y, r), top = _mm_add_ps(y, r);
+			_mm_storeu_ps(&tileMinX[i], _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_mul_ps(left, invNear), _mm_mul_ps(left, invFar)), scaleX), originX));
+			_mm_storeu_ps(&tileMaxX[i], _mm_add_ps(_mm_mul_ps(_mm_max_ps(_mm_mul_ps(right, invNear), _mm_mul_ps(right, invFar)), scaleX), originX));
+			_mm_storeu_ps(&tileMinY[i], _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_mul_ps(bottom, invNear), _mm_mul_ps(bottom, invFar)), scaleY), originY));
+			_mm_storeu_ps(&tileMaxY[i], _mm_add_ps(_mm_mul_ps(_mm_max_ps(_mm_mul_ps(top, invNear), _mm_mul_ps(top, invFar)), scaleY), originY));
+		}
+#else
+		for (std::size_t i = begin; i < end; i++)
+		{
+			const float invNear = 1.0f / std::max(depth[i] - radius[i], nearPlane);
+			const float invFar = 1.0f / std::min(depth[i] + radius[i], farPlane);
+			const float left = centreX[i] - radius[i], right = centreX[i] + radius[i];
+			const float bottom = centreY[i] - radius[i], top = centreY[i] + radius[i];
+			tileMinX[i] = std::min(left * invNear, left * invFar) * tileScaleX + offsetX;
+			tileMaxX[i] = std::max(right * invNear, right * invFar) * tileScaleX + offsetX;
+			tileMinY[i] = std::min(bottom * invNear, bottom * invFar) * tileScaleY + offsetY;
+			tileMaxY[i] = std::max(top * invNear, top * invFar) * tileScaleY + offsetY;
+		}
+#endif
+	}
+	// drop the lights outside the frustum, turn the rest into cluster ranges and count them per cluster
+	// ------------------------------------------------------------------------
+	void assignRanges(std::size_t begin, std::size_t end, Worker& worker) const
+	{
+		auto tile = [](float t, unsigned int grid) { return (std::uint8_t)std::clamp(t, 0.0f, grid - 1.0f); };
+		auto slice = [this](float d) { return (std::uint8_t)std::clamp(std::log(d) * depthScale + depthBias, 0.0f, CLUSTER_GRID_Z - 1.0f); };
+		for (std::size_t i = begin; i < end; i++)
+		{
+			const float nearDepth = depth[i] - radius[i], farDepth = depth[i] + radius[i];
+			if (!(radius[i] > 0.0f) || farDepth < nearPlane || nearDepth > farPlane
+				|| tileMaxX[i] < 0.0f || tileMinX[i] >= CLUSTER_GRID_X || tileMaxY[i] < 0.0f || tileMinY[i] >= CLUSTER_GRID_Y)
+				continue;
+			const ClusterRange range{ (std::uint32_t)i,
+				tile(tileMinX[i], CLUSTER_GRID_X), tile(tileMaxX[i], CLUSTER_GRID_X),
+				tile(tileMinY[i], CLUSTER_GRID_Y), tile(tileMaxY[i], CLUSTER_GRID_Y),
+				slice(std::max(nearDepth, nearPlane)), slice(std::min(farDepth, farPlane)) };
+			for (unsigned int z = range.minZ; z <= range.maxZ; z++)
+				for (unsigned int y = range.minY; y <= range.maxY; y++)
+					for (unsigned int x = range.minX; x <= range.maxX; x++)
+						worker.counts[(z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x]++;
+			worker.ranges.push_back(range);
+		}
+	}
+	// counts now hold this worker's first free slot in each cluster's run
+	// ------------------------------------------------------------------------
+	void writeIndices(Worker& worker)
+	{
+		for (const ClusterRange& range : worker.ranges)
+			for (unsigned int z = range.minZ; z <= range.maxZ; z++)
+				for (unsigned int y = range.minY; y <= range.maxY; y++)
+					for (unsigned int x = range.minX; x <= range.maxX; x++)
+						lightIndices[worker.counts[(z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x]++] = range.light;
+	}
+};
+#endif
@@ -0,0 +1,198 @@
+#ifndef LIGHT_MANAGER_H
+#define LIGHT_MANAGER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "gl_state_cache.h"
+#include "lights.h"
+
+#include <vector>
+#include <iostream>
+#include <cstddef>
+#include <algorithm>
+
+// Every light in the scene, kept in CPU arrays that mirror the GPU copies exactly:
+//   - the directional and spot light in the std140 Lights block (LightsBuffer),
+//   - the point lights back to back in a texture buffer, five RGBA32F texels per PointLight,
+//     read with texelFetch by the fragment shader up to its pointLightCount uniform.
+// GL 3.3 has no shader storage buffers and uniform blocks top out at a few hundred point lights.
+// A texture buffer is bounded by GL_MAX_TEXTURE_BUFFER_SIZE texels instead, at least 65536 (about
+// 13k point lights) and usually far more; addPointLight refuses lights past that. Setters only mark
+// what changed; upload() sends the changed point lights as coalesced runs, so its cost follows the
+// number of edits, not the light count.
+class LightManager
+{
+public:
+	// what the last upload() sent, for the per-frame report
+	struct UploadStats
+	{
+		std::size_t pointLights = 0;
+		std::size_t ranges = 0;
+		std::size_t bytes = 0;
+	};
+
+	LightManager()
+	{
+		glGenBuffers(1, &pointLightBuffer);
+		glGenTextures(1, &pointLightTexture);
+		int texels = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+		maxLights = (std::size_t)texels / TEXELS_PER_LIGHT;
+		reserve(std::min<std::size_t>(64, maxLights));
+	}
+	// free the GL objects, call before the context goes away
+	// ------------------------------------------------------------------------
+	void release()
+	{
+		glState.deleteTextures(1, &pointLightTexture);
+		glState.deleteBuffers(1, &pointLightBuffer);
+		glState.deleteBuffers(1, &lightsBuffer.UBO);
+	}
+
+	// directional and spot light, uploaded whole whenever either changes
+	// ------------------------------------------------------------------------
+	const DirLight& dirLight() const { return block.dirLight; }
+	const SpotLight& spotLight() const { return block.spotLight; }
+	void setDirLight(const DirLight& light)
+	{
+		block.dirLight = light;
+		blockDirty = true;
+	}
+	void setSpotLight(const SpotLight& light)
+	{
+		block.spotLight = light;
+		blockDirty = true;
+	}
+
+	// point lights, addressed by index; removing swaps the last light into the hole.
+	// addPointLight returns the new index, or pointLightCount() when the texture buffer is full
+	// ------------------------------------------------------------------------
+	std::size_t pointLightCount() const { return pointLights.size(); }
+	std::size_t maxPointLights() const { return maxLights; }
+	const PointLight& pointLight(std::size_t index) const { return pointLights[index]; }
+	std::size_t addPointLight(const PointLight& light)
+	{
+		if (pointLights.size() >= maxLights)
+		{
+			std::cout << "ERROR::LIGHT_MANAGER::TOO_MANY_POINT_LIGHTS\n" << maxLights
+				<< " fit in GL_MAX_TEXTURE_BUFFER_SIZE, the light was not added" << std::endl;
+			return pointLights.size();
+		}
+		pointLights.push_back(light);
+		dirty.push_back(false);
+		markDirty(pointLights.size() - 1);
+		return pointLights.size() - 1;
+	}
+	void setPointLight(std::size_t index, const PointLight& light)
+	{
+		pointLights[index] = light;
+		markDirty(index);
+	}
+	void removePointLight(std::size_t index)
+	{
+		const std::size_t last = pointLights.size() - 1;
+		if (index != last)
+		{
+			pointLights[index] = pointLights[last];
+			markDirty(index);
+		}
+		pointLights.pop_back();
+		dirty.pop_back();
+	}
+
+	// send everything that changed since the last call
+	// ------------------------------------------------------------------------
+	UploadStats upload()
+	{
+		UploadStats stats;
+		if (blockDirty)
+		{
+			lightsBuffer.upload(block);
+			blockDirty = false;
+		}
+		if (pointLights.size() > capacity)
+		{
+			// grow geometrically and send the whole array once, the old storage is gone anyway
+			reserve(std::min(std::max(pointLights.size(), capacity * 2), maxLights));
+			glState.bindBuffer(GL_TEXTURE_BUFFER, pointLightBuffer);
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, pointLights.size() * sizeof(PointLight), pointLights.data());
+			glState.bindBuffer(GL_TEXTURE_BUFFER, 0);
+			stats = { pointLights.size(), 1, pointLights.size() * sizeof(PointLight) };
+			clearDirty();
+			return stats;
+		}
+
+		std::sort(dirtyIndices.begin(), dirtyIndices.end());
+		glState.bindBuffer(GL_TEXTURE_BUFFER, pointLightBuffer);
+		for (std::size_t i = 0; i < dirtyIndices.size();)
+		{
+			const std::size_t first = dirtyIndices[i];
+			std::size_t end = first + 1;
+			while (++i < dirtyIndices.size() && dirtyIndices[i] <= end)
+				end = std::max(end, dirtyIndices[i] + 1); // neighbours and re-added duplicates
+			if (first >= pointLights.size())
+				break; // removed since it was marked, everything after it is gone too
+			end = std::min(end, pointLights.size());
+			glBufferSubData(GL_TEXTURE_BUFFER, first * sizeof(PointLight), (end - first) * sizeof(PointLight), &pointLights[first]);
+			stats.pointLights += end - first;
+			stats.ranges++;
+		}
+		glState.bindBuffer(GL_TEXTURE_BUFFER, 0);
+		stats.bytes = stats.pointLights * sizeof(PointLight);
+		clearDirty();
+		return stats;
+	}
+
+	// bind the point light texture buffer for "uniform samplerBuffer pointLightData"
+	// ------------------------------------------------------------------------
+	void bindPointLights(unsigned int textureUnit) const
+	{
+		glState.activeTexture(GL_TEXTURE0 + textureUnit);
+		glState.bindTexture(GL_TEXTURE_BUFFER, pointLightTexture);
+		glState.activeTexture(GL_TEXTURE0);
+	}
+
+private:
+	static constexpr std::size_t TEXELS_PER_LIGHT = sizeof(PointLight) / (4 * sizeof(float)); // RGBA32F
+
+	LightsBuffer lightsBuffer;
+	LightsBlock block{};
+	bool blockDirty = true;
+
+	std::vector<PointLight> pointLights;
+	std::vector<bool> dirty; // parallel to pointLights, keeps dirtyIndices free of duplicates
+	std::vector<std::size_t> dirtyIndices;
+	std::size_t capacity = 0;
+	std::size_t maxLights = 0;
+	unsigned int pointLightBuffer;
+	unsigned int pointLightTexture;
+
+	void markDirty(std::size_t index)
+	{
+		if (dirty[index])
+			return;
+		dirty[index] = true;
+		dirtyIndices.push_back(index);
+	}
+	void clearDirty()
+	{
+		for (std::size_t index : dirtyIndices)
+		{
+			if (index < dirty.size())
+				dirty[index] = false;
+		}
+		dirtyIndices.clear();
+	}
+	void reserve(std::size_t lights)
+	{
+		capacity = lights;
+		glState.bindBuffer(GL_TEXTURE_BUFFER, pointLightBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(PointLight), NULL, GL_DYNAMIC_DRAW);
+		glState.bindBuffer(GL_TEXTURE_BUFFER, 0);
+		// the texture keeps pointing at the buffer object, re-attach so it sees the new storage
+		glState.bindTexture(GL_TEXTURE_BUFFER, pointLightTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, pointLightBuffer);
+		glState.bindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+};
+#endif
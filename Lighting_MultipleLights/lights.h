@@ -0,0 +1,174 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "gl_state_cache.h"
+#include "block_layout.h"
+#include "shaders.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// C++ mirrors of the light structs in basic_lighting_obj.glslf, laid out for the std140 Lights
+// block. Material keeps its own plain uniforms because samplers cannot live in a block. Point
+// lights use the same std140 layout but live in LightManager's texture buffer, see light_manager.h.
+
+struct DirLight
+{
+	alignas(std140Alignment<glm::vec3>) glm::vec3 direction;
+
+	alignas(std140Alignment<glm::vec3>) glm::vec3 ambient;
+	alignas(std140Alignment<glm::vec3>) glm::vec3 diffuse;
+	alignas(std140Alignment<glm::vec3>) glm::vec3 specular;
+};
+static_assert(offsetof(DirLight, direction) == 0, "std140 offset mismatch");
+static_assert(offsetof(DirLight, ambient) == 16, "std140 offset mismatch");
+static_assert(offsetof(DirLight, diffuse) == 32, "std140 offset mismatch");
+static_assert(offsetof(DirLight, specular) == 48, "std140 offset mismatch");
+static_assert(sizeof(DirLight) == 64, "std140 size mismatch");
+
+struct PointLight
+{
+	alignas(std140Alignment<glm::vec3>) glm::vec3 position;
+
+	alignas(std140Alignment<float>) float constant;
+	alignas(std140Alignment<float>) float linear;
+	alignas(std140Alignment<float>) float quadratic;
+
+	alignas(std140Alignment<glm::vec3>) glm::vec3 ambient;
+	alignas(std140Alignment<glm::vec3>) glm::vec3 diffuse;
+	alignas(std140Alignment<glm::vec3>) glm::vec3 specular;
+};
+static_assert(offsetof(PointLight, position) == 0, "std140 offset mismatch");
+static_assert(offsetof(PointLight, constant) == 12, "std140 offset mismatch");
+static_assert(offsetof(PointLight, linear) == 16, "std140 offset mismatch");
+static_assert(offsetof(PointLight, quadratic) == 20, "std140 offset mismatch");
+static_assert(offsetof(PointLight, ambient) == 32, "std140 offset mismatch");
+static_assert(offsetof(PointLight, diffuse) == 48, "std140 offset mismatch");
+static_assert(offsetof(PointLight, specular) == 64, "std140 offset mismatch");
+static_assert(sizeof(PointLight) == glslArrayStride<BlockLayout::STD140, PointLight>(), "std140 stride mismatch");
+static_assert(sizeof(PointLight) == 5 * sizeof(glm::vec4), "fetchPointLight in the shader reads five texels");
+
+struct SpotLight
+{
+	alignas(std140Alignment<glm::vec3>) glm::vec3 position;
+	alignas(std140Alignment<glm::vec3>) glm::vec3 direction;
+	alignas(std140Alignment<float>) float cutOff;
+	alignas(std140Alignment<float>) float outerCutOff;
+
+	alignas(std140Alignment<float>) float constant;
+	alignas(std140Alignment<float>) float linear;
+	alignas(std140Alignment<float>) float quadratic;
+
+	alignas(std140Alignment<glm::vec3>) glm::vec3 ambient;
+	alignas(std140Alignment<glm::vec3>) glm::vec3 diffuse;
+	alignas(std140Alignment<glm::vec3>) glm::vec3 specular;
+};
+static_assert(offsetof(SpotLight, direction) == 16, "std140 offset mismatch");
+static_assert(offsetof(SpotLight, cutOff) == 28, "std140 offset mismatch");
+static_assert(offsetof(SpotLight, outerCutOff) == 32, "std140 offset mismatch");
+static_assert(offsetof(SpotLight, quadratic) == 44, "std140 offset mismatch");
+static_assert(offsetof(SpotLight, ambient) == 48, "std140 offset mismatch");
+static_assert(offsetof(SpotLight, specular) == 80, "std140 offset mismatch");
+static_assert(sizeof(SpotLight) == 96, "std140 size mismatch");
+
+struct LightsBlock
+{
+	alignas(std140Alignment<DirLight>) DirLight dirLight;
+	alignas(std140Alignment<SpotLight>) SpotLight spotLight;
+};
+static_assert(offsetof(LightsBlock, spotLight) == 64, "std140 offset mismatch");
+static_assert(sizeof(LightsBlock) == 160, "std140 size mismatch");
+
+// every member name the shader sees together with its C++ offset, for verifyBlockOffsets
+// ------------------------------------------------------------------------
+inline std::vector<BlockMemberOffset> lightsBlockMembers()
+{
+	return {
+		{ "dirLight.direction", offsetof(LightsBlock, dirLight) + offsetof(DirLight, direction) },
+		{ "dirLight.ambient", offsetof(LightsBlock, dirLight) + offsetof(DirLight, ambient) },
+		{ "dirLight.diffuse", offsetof(LightsBlock, dirLight) + offsetof(DirLight, diffuse) },
+		{ "dirLight.specular", offsetof(LightsBlock, dirLight) + offsetof(DirLight, specular) },
+		{ "spotLight.position", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, position) },
+		{ "spotLight.direction", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, direction) },
+		{ "spotLight.cutOff", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, cutOff) },
+		{ "spotLight.outerCutOff", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, outerCutOff) },
+		{ "spotLight.constant", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, constant) },
+		{ "spotLight.linear", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, linear) },
+		{ "spotLight.quadratic", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, quadratic) },
+		{ "spotLight.ambient", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, ambient) },
+		{ "spotLight.diffuse", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, diffuse) },
+		{ "spotLight.specular", offsetof(LightsBlock, spotLight) + offsetof(SpotLight, specular) },
+	};
+}
+
+// feature bits for the basic_lighting_obj variants, see ShaderVariants
+// ------------------------------------------------------------------------
+enum LightingFeature : std::uint32_t
+{
+	LIGHTING_DIR_LIGHT = 1 << 0,
+	LIGHTING_SPOT_LIGHT = 1 << 1,
+	LIGHTING_INSTANCED = 1 << 2, // per-instance model/normal matrix attributes instead of uniforms
+	LIGHTING_CLUSTERED = 1 << 3, // point lights from LightClusters' per-cluster lists instead of all of them
+	LIGHTING_DIR_SHADOWS = 1 << 4, // the directional light is shadowed by ShadowCascades
+	LIGHTING_POINT_SHADOWS = 1 << 5, // the point lights are shadowed by PointShadowAtlas
+	LIGHTING_POINT_LIGHT_SHIFT = 8, // bits 8..15 hold the point light count
+};
+// point light count meaning "loop over the pointLightCount uniform" instead of a constant
+const unsigned int DYNAMIC_POINT_LIGHT_COUNT = 0xFF;
+constexpr std::uint32_t lightingFeatures(unsigned int pointLights, bool dirLight, bool spotLight)
+{
+	return (pointLights << LIGHTING_POINT_LIGHT_SHIFT) | (dirLight ? LIGHTING_DIR_LIGHT : 0u)
+		| (spotLight ? LIGHTING_SPOT_LIGHT : 0u);
+}
+// LightClusters' grid, 16x9 tiles on screen times 24 depth slices; baked into the CLUSTERED variants
+const unsigned int CLUSTER_GRID_X = 16;
+const unsigned int CLUSTER_GRID_Y = 9;
+const unsigned int CLUSTER_GRID_Z = 24;
+// ShadowCascades' layer count, baked into the DIR_SHADOWS variants; the shader keeps the split depths in one vec4
+const unsigned int SHADOW_CASCADE_COUNT = 4;
+// everything on, identical to compiling the shader without any defines
+inline constexpr std::uint32_t LIGHTING_UBER_SHADER = lightingFeatures(DYNAMIC_POINT_LIGHT_COUNT, true, true) | LIGHTING_DIR_SHADOWS | LIGHTING_POINT_SHADOWS;
+
+inline std::string lightingDefines(std::uint32_t features)
+{
+	const unsigned int pointLights = (features >> LIGHTING_POINT_LIGHT_SHIFT) & 0xFF;
+	return "#define NR_POINT_LIGHTS " + (pointLights == DYNAMIC_POINT_LIGHT_COUNT ? std::string("-1") : std::to_string(pointLights)) + "\n"
+		+ "#define HAS_DIR_LIGHT " + ((features & LIGHTING_DIR_LIGHT) ? "1" : "0") + "\n"
+		+ "#define HAS_SPOT_LIGHT " + ((features & LIGHTING_SPOT_LIGHT) ? "1" : "0") + "\n"
+		+ "#define INSTANCED " + ((features & LIGHTING_INSTANCED) ? "1" : "0") + "\n"
+		+ "#define CLUSTERED " + ((features & LIGHTING_CLUSTERED) ? "1" : "0") + "\n"
+		+ "#define CLUSTER_GRID_X " + std::to_string(CLUSTER_GRID_X) + "\n"
+		+ "#define CLUSTER_GRID_Y " + std::to_string(CLUSTER_GRID_Y) + "\n"
+		+ "#define CLUSTER_GRID_Z " + std::to_string(CLUSTER_GRID_Z) + "\n"
+		+ "#define DIR_SHADOWS " + ((features & LIGHTING_DIR_SHADOWS) ? "1" : "0") + "\n"
+		+ "#define SHADOW_CASCADE_COUNT " + std::to_string(SHADOW_CASCADE_COUNT) + "\n"
+		+ "#define POINT_SHADOWS " + ((features & LIGHTING_POINT_SHADOWS) ? "1" : "0") + "\n";
+}
+
+// One uniform buffer bound at LIGHTS_BINDING; directional and spot light go up in one glBufferSubData.
+class LightsBuffer
+{
+public:
+	unsigned int UBO;
+
+	LightsBuffer()
+	{
+		glGenBuffers(1, &UBO);
+		glState.bindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsBlock), NULL, GL_DYNAMIC_DRAW);
+		glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+		glState.bindBufferBase(GL_UNIFORM_BUFFER, LIGHTS_BINDING, UBO);
+	}
+
+	void upload(const LightsBlock& lights)
+	{
+		glState.bindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightsBlock), &lights);
+		glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+};
+#endif
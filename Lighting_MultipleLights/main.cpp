@@ -8,11 +8,31 @@
 #pragma warning(push, 1)
 #include <stb_image.h>
 #pragma warning(pop)
+#include "gl_extensions.h"
+#include "gl_state_cache.h"
 #include "shaders.h"
+#include "frame_ring_buffer.h"
+#include "frame_constants.h"
+#include "lights.h"
+#include "light_manager.h"
+#include "worker_pool.h"
+#include "light_clusters.h"
+#include "deferred_renderer.h"
+#include "shadow_cascades.h"
+#include "point_shadow_atlas.h"
+#include "scene_bvh.h"
+#include "occlusion_culler.h"
+#include "shader_variants.h"
+#include "cube_instances.h"
+#include "render_queue.h"
 #include "camera.h"
+#include "normal_matrix.h"
 
 #include <iostream>
+#include <vector>
 #include <filesystem>
+#include <algorithm>
+#include <utility>
 
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -34,6 +54,40 @@ float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
 bool view_locked = true;
+// scene switches: 0-4 point lights, F/G flashlight on/off, U uber-shader, P specialised variant,
+// F1-F6 10^n cubes, I instanced cubes, O one draw call per cube, L/K swarm of small lights on/off,
+// C/V clustered point lights on/off, R/T deferred/forward shading, B light count sweep (4 to 4096 lights,
+// flat loop against clustered), N overdraw sweep (up to 10000 cubes drawn back to front, forward against deferred),
+// Y/H directional light shadows on/off, J/M point light shadows on/off, X/Z frustum culling on/off,
+// F7 culling benchmark (a million cubes, BVH against testing every cube), F8/F9 occlusion culling on/off
+const unsigned int SCENE_POINT_LIGHTS = 4;
+const std::size_t SWARM_LIGHTS = 1024;
+const std::size_t SWARM_MOVES_PER_FRAME = 64;
+unsigned int activePointLights = SCENE_POINT_LIGHTS;
+std::size_t swarmLights = 0;
+bool clusteredShading = false;
+bool deferredShading = false;
+bool cubesBackToFront = false;
+bool lightSweepRequested = false;
+bool overdrawSweepRequested = false;
+bool flashlightOn = true;
+bool dirShadowsOn = true;
+bool pointShadowsOn = true;
+bool useUberShader = false;
+std::size_t sceneCubes = 10;
+bool drawInstanced = true;
+bool frustumCulling = true;
+bool occlusionCulling = true;
+bool cullBenchmarkRequested = false;
+
+// one configuration of a benchmark sweep, rendered for a few frames and printed as one line
+struct SweepRun
+{
+	std::size_t pointLights;
+	std::size_t cubes;
+	bool clustered;
+	bool deferred;
+};
 
 unsigned int loadTexture(char const* path)
 {
@@ -52,7 +106,7 @@ unsigned int loadTexture(char const* path)
 		else if (nrComponents == 4)
 			format = GL_RGBA;
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		glState.bindTexture(GL_TEXTURE_2D, textureID);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -72,6 +126,73 @@ unsigned int loadTexture(char const* path)
 	return textureID;
 }
 
+// Frustum culling of a million cubes from a camera turning once around itself, each view culled
+// through the BVH and by testing every cube's box, then a tenth of a percent of the cubes moved
+// and refitted. Prints the averages.
+// ------------------------------------------------------------------------
+void runCullBenchmark(const glm::vec3* classicPositions, std::size_t classicCount, const Aabb& cubeBox)
+{
+	const std::size_t CUBES = 1000000;
+	const unsigned int VIEWS = 64;
+	const std::size_t MOVED = 1000;
+	const std::vector<CubeInstance> cubes = generateCubeScene(classicPositions, classicCount, CUBES);
+	std::vector<Aabb> boxes;
+	boxes.reserve(cubes.size());
+	for (const CubeInstance& cube : cubes)
+		boxes.push_back(transformAabb(cubeBox, cube.model));
+	SceneBvh bvh;
+	double start = glfwGetTime();
+	bvh.build(boxes);
+	const double buildTime = glfwGetTime() - start;
+
+	const glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+	std::vector<std::uint32_t> visible;
+	double bvhTime = 0.0, bruteTime = 0.0;
+	std::size_t visibleTotal = 0, nodesTested = 0, mismatches = 0;
+	for (unsigned int v = 0; v < VIEWS; v++)
+	{
+		const float yaw = glm::radians(-90.0f + 360.0f * v / VIEWS), pitch = glm::radians(20.0f * std::sin(v * 0.7f));
+		const glm::vec3 front(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch));
+		const Frustum frustum = frustumFromMatrix(projection * glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, 3.0f) + front, glm::vec3(0.0f, 1.0f, 0.0f)));
+		start = glfwGetTime();
+		const SceneBvh::CullStats stats = bvh.cull(frustum, visible);
+		bvhTime += glfwGetTime() - start;
+		visibleTotal += stats.visible;
+		nodesTested += stats.nodesTested;
+
+		start = glfwGetTime();
+		std::size_t bruteVisible = 0;
+		for (const Aabb& box : boxes)
+		{
+			bool outside = false;
+			for (const glm::vec4& plane : frustum.planes)
+			{
+				const glm::vec3 furthest = glm::max(glm::vec3(plane) * box.lower, glm::vec3(plane) * box.upper);
+				outside |= furthest.x + furthest.y + furthest.z + plane.w < 0.0f;
+			}
+			bruteVisible += outside ? 0 : 1;
+		}
+		bruteTime += glfwGetTime() - start;
+		mismatches += bruteVisible != stats.visible;
+	}
+
+	start = glfwGetTime();
+	for (std::size_t i = 0; i < MOVED; i++)
+	{
+		const std::size_t cube = i * (CUBES / MOVED);
+		boxes[cube].lower.y += 0.5f;
+		boxes[cube].upper.y += 0.5f;
+		bvh.refit((std::uint32_t)cube, boxes[cube]);
+	}
+	const double refitTime = glfwGetTime() - start;
+
+	std::cout << "Cull benchmark: " << CUBES << " cubes, BVH of " << bvh.nodeCount() << " nodes built in " << buildTime * 1000.0 << " ms" << std::endl;
+	std::cout << "  per view (" << VIEWS << " views): BVH " << bvhTime / VIEWS * 1000.0 << " ms (" << nodesTested / VIEWS << " nodes tested), every box "
+		<< bruteTime / VIEWS * 1000.0 << " ms; " << visibleTotal / VIEWS << " visible, " << CUBES - visibleTotal / VIEWS << " rejected"
+		<< (mismatches ? ", VISIBLE COUNTS DIFFER" : "") << std::endl;
+	std::cout << "  refit after moving " << MOVED << " cubes: " << refitTime * 1000.0 << " ms" << std::endl;
+}
+
 int main()
 {
 	// glfw: initialize and configure
@@ -109,15 +230,24 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	loadGLExtensions((GLADloadproc)glfwGetProcAddress);
 
 	// configure global opengl state
 	// -----------------------------
-	glEnable(GL_DEPTH_TEST);
+	glState.enable(GL_DEPTH_TEST);
 
 	// build and compile our shader zprogram
 	// ------------------------------------
-	Shader lightingShader("basic_lighting_obj.glslv", "basic_lighting_obj.glslf");
-	Shader lightCubeShader("light_cube.glslv", "light_cube.glslf");
+	// both programs are only submitted here, the driver compiles them while we load the textures
+	const double shaderBuildStart = glfwGetTime();
+	// the lighting shader is specialised per light setup, only the uber variant is prewarmed here
+	ShaderVariants lightingVariants("basic_lighting_obj.glslv", "basic_lighting_obj.glslf", lightingDefines);
+	ShaderBatch shaderBatch;
+	const std::size_t lightingProgram = shaderBatch.add(lightingVariants.vertex().c_str(), lightingVariants.fragment().c_str(),
+		lightingVariants.defines(LIGHTING_UBER_SHADER));
+	const std::size_t lightCubeProgram = shaderBatch.add("light_cube.glslv", "light_cube.glslf");
+	const std::size_t shadowDepthProgram = shaderBatch.add("shadow_depth.glslv", "shadow_depth.glslf");
+	const double shaderSubmitTime = glfwGetTime() - shaderBuildStart;
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
@@ -170,10 +300,10 @@ int main()
 	glGenVertexArrays(1, &cubeVAO);
 	glGenBuffers(1, &VBO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-	glBindVertexArray(cubeVAO);
+	glState.bindVertexArray(cubeVAO);
 	// position attribute
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -182,26 +312,58 @@ int main()
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
 	glEnableVertexAttribArray(2);
+	// per-instance transforms for the instanced path, filled once the scene is generated: the lit pass
+	// draws the cubes that survive frustum culling, the shadow pass every cube from its own buffer
+	// since casters outside the view still throw shadows into it
+	CubeInstanceBuffer cubeInstances, drawnCubeInstances;
+	drawnCubeInstances.attach();
 
 	// second, configure the light's VAO (VBO stays the same; the vertices are the same for the light object which is also a 3D cube)
 	unsigned int lightCubeVAO;
 	glGenVertexArrays(1, &lightCubeVAO);
-	glBindVertexArray(lightCubeVAO);
+	glState.bindVertexArray(lightCubeVAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
 	// note that we update the lamp's position attribute's stride to reflect the updated buffer data
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 
+	// third, the shadow pass' VAO: a tightly packed copy of the positions and the instance model matrices,
+	// so drawing the casters into every cascade fetches 12 bytes per vertex instead of 32
+	std::vector<glm::vec3> cubeVertexPositions;
+	for (std::size_t i = 0; i < sizeof(vertices) / sizeof(float); i += 8)
+		cubeVertexPositions.emplace_back(vertices[i], vertices[i + 1], vertices[i + 2]);
+	unsigned int shadowVBO, shadowCubeVAO;
+	glGenVertexArrays(1, &shadowCubeVAO);
+	glGenBuffers(1, &shadowVBO);
+	glState.bindVertexArray(shadowCubeVAO);
+	glState.bindBuffer(GL_ARRAY_BUFFER, shadowVBO);
+	glBufferData(GL_ARRAY_BUFFER, cubeVertexPositions.size() * sizeof(glm::vec3), cubeVertexPositions.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	glEnableVertexAttribArray(0);
+	cubeInstances.attachModel();
+
 	unsigned int diffuseMap = loadTexture("container2.png");
 	unsigned int specularMap = loadTexture("container2_specular.png");
 	//unsigned int emissionMap = loadTexture("matrix.jpg");
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, diffuseMap);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, specularMap);
+	glState.activeTexture(GL_TEXTURE0);
+	glState.bindTexture(GL_TEXTURE_2D, diffuseMap);
+	glState.activeTexture(GL_TEXTURE1);
+	glState.bindTexture(GL_TEXTURE_2D, specularMap);
 	//glActiveTexture(GL_TEXTURE2);
 	//glBindTexture(GL_TEXTURE_2D, emissionMap);
+	const RenderMaterial containerMaterial{ diffuseMap, specularMap };
+
+	// collect the shader programs, this is the only place that may wait on the driver
+	const double shaderFinishStart = glfwGetTime();
+	std::vector<Shader> shaders = shaderBatch.finish();
+	lightingVariants.adopt(LIGHTING_UBER_SHADER, shaders[lightingProgram]);
+	const Shader& uberShader = lightingVariants.get(LIGHTING_UBER_SHADER);
+	const Shader& lightCubeShader = shaders[lightCubeProgram];
+	const Shader& shadowDepthShader = shaders[shadowDepthProgram];
+	std::cout << "Shaders submitted in " << shaderSubmitTime * 1000.0 << " ms, finish() waited "
+		<< (glfwGetTime() - shaderFinishStart) * 1000.0 << " ms ("
+		<< (uberShader.loadedFromCache && lightCubeShader.loadedFromCache && shadowDepthShader.loadedFromCache ? "warm, program binary cache" : "cold, compiled from GLSL") << ")" << std::endl;
 
 	const glm::vec3 cubePositions[] = {
 		glm::vec3(0.0f,  0.0f,  0.0f),
@@ -215,6 +377,8 @@ int main()
 		glm::vec3(1.5f,  0.2f, -1.5f),
 		glm::vec3(-1.3f,  1.0f, -1.5f)
 	};
+	// the cube's model space box, the vertices above span -0.5 to 0.5
+	const Aabb cubeBox{ glm::vec3(-0.5f), glm::vec3(0.5f) };
 
 	glm::vec3 pointLightPositions[] = {
 	   glm::vec3(0.7f,  0.2f,  2.0f),
@@ -224,9 +388,121 @@ int main()
 	};
 
 	glm::vec3 lightPos(0.0f, 0.0f, -2.0f);
-	lightingShader.use();
-	lightingShader.setInt("material.diffuse", 0);
-	lightingShader.setInt("material.specular", 1);
+
+	// what is rewritten every frame, the camera block and the culled instance list, streams through
+	// one ring of three regions; 8 MB a region holds the camera and about 80000 cube instances
+	FrameRingBuffer frameRing(8 * 1024 * 1024);
+	// camera matrices live in one uniform block that both programs read
+	FrameConstantsBuffer frameConstants(frameRing);
+
+	// all lights live in the LightManager, which only uploads what changed since the last frame
+	// -----------------------------------------------------------------------------------
+	LightManager lightManager;
+	lightManager.bindPointLights(2);
+	verifyBlockOffsets(uberShader.ID, "Lights", lightsBlockMembers());
+	// directional light
+	DirLight dirLight{};
+	dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+	dirLight.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+	dirLight.diffuse = glm::vec3(0.4f, 0.4f, 0.4f);
+	dirLight.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+	lightManager.setDirLight(dirLight);
+	// point lights; switched off ones keep their slot with zero colour
+	auto scenePointLight = [&](unsigned int i, bool on)
+	{
+		PointLight light{};
+		light.position = pointLightPositions[i];
+		light.ambient = on ? glm::vec3(0.05f, 0.05f, 0.05f) : glm::vec3(0.0f);
+		light.diffuse = on ? glm::vec3(0.8f, 0.8f, 0.8f) : glm::vec3(0.0f);
+		light.specular = on ? glm::vec3(1.0f, 1.0f, 1.0f) : glm::vec3(0.0f);
+		light.constant = 1.0f;
+		light.linear = 0.09f;
+		light.quadratic = 0.032f;
+		return light;
+	};
+	for (unsigned int i = 0; i < SCENE_POINT_LIGHTS; i++)
+		lightManager.addPointLight(scenePointLight(i, true));
+	unsigned int litPointLights = SCENE_POINT_LIGHTS;
+	// the swarm: small coloured lights drifting between the cubes, a few of them move every frame
+	std::vector<glm::vec3> swarmOrigins;
+	std::size_t swarmCursor = 0;
+	// threads for the per-frame CPU work split over the cores, started once
+	WorkerPool workerPool;
+	// the point lights per cluster of the view frustum, rebuilt every frame while clustered shading is on
+	LightClusters lightClusters(workerPool);
+	lightClusters.bind(3, 4);
+	LightClusters::BuildStats clusterStats;
+	double clusterBuildTime = 0.0;
+	// the deferred path: G-buffer programs share the cube vertex shader, the lighting programs are
+	// the fullscreen directional/spot pass and the point light volumes
+	DeferredRenderer deferredRenderer;
+	ShaderVariants gBufferVariants("basic_lighting_obj.glslv", "deferred_gbuffer.glslf", lightingDefines);
+	ShaderVariants deferredLightVariants("deferred_light.glslv", "deferred_light.glslf", lightingDefines);
+	// the directional light's cascaded shadow maps, redrawn only when a cascade's cached box no longer fits
+	ShadowCascades shadowCascades;
+	unsigned int shadowCascadeRenders = 0;
+	// the point lights' shadows, in one atlas and redrawn within a per-frame budget
+	PointShadowAtlas pointShadows;
+	double pointShadowScheduleTime = 0.0;
+	// spotLight
+	SpotLight flashlight{};
+	flashlight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+	flashlight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	flashlight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+	flashlight.constant = 1.0f;
+	flashlight.linear = 0.09f;
+	flashlight.quadratic = 0.032f;
+	flashlight.cutOff = glm::cos(glm::radians(12.5f));
+	flashlight.outerCutOff = glm::cos(glm::radians(15.0f));
+
+	// the lit cubes and the lamps go through one queue, sorted by state and depth before they are drawn
+	RenderQueue renderQueue;
+	std::vector<glm::mat4> lampModels;
+	double renderQueueSortTime = 0.0;
+	// report how many set* calls the shadow copies in Shader kept away from the driver
+	float lastStatsReport = 0.0f;
+	// GPU time of the lit cubes, to compare the uber-shader against the specialised variants; a ring of
+	// queries so a result is only read once the GPU has it, never waited for
+	constexpr unsigned int LIT_PASS_QUERIES = 3;
+	unsigned int litPassQueries[LIT_PASS_QUERIES];
+	glGenQueries(LIT_PASS_QUERIES, litPassQueries);
+	bool litPassQueryPending[LIT_PASS_QUERIES] = {};
+	unsigned int litPassQuery = 0;
+	double litPassTime = 0.0;
+	unsigned int litPassFrames = 0;
+	// the cube transforms only change with the scene size, so both paths reuse them every frame
+	std::vector<CubeInstance> cubeScene;
+	bool cubeSceneBackToFront = false;
+	// the BVH over the cubes' boxes and what the lit pass drew last, refilled when the visible set changes
+	SceneBvh cubeBvh;
+	std::vector<Aabb> cubeBoxes;
+	std::vector<std::uint32_t> visibleCubes, drawnCubeIndices;
+	std::vector<CubeInstance> culledCubes;
+	bool drawnCubesCulled = false, drawnCubesStale = true;
+	// drawnCubeInstances holds the list the lit pass draws, false while it streams from frameRing
+	bool drawnCubeBufferCurrent = false, drawnCubesStreamed = false;
+	SceneBvh::CullStats cullStats;
+	double cullTime = 0.0;
+	// occlusion culling after the frustum culling: the cubes nearest to the camera are the largest
+	// on screen, OCCLUDER_CUBES of them are drawn into the CPU depth buffer and hide what is behind
+	const std::size_t OCCLUDER_CUBES = 32;
+	OcclusionCuller occlusionCuller(workerPool);
+	OcclusionCuller::RasterStats occluderStats;
+	std::vector<glm::mat4> occluderModels;
+	std::vector<std::pair<float, std::uint32_t>> occluderCandidates;
+	std::size_t occlusionTested = 0, occludedCubes = 0;
+	double occluderRasterTime = 0.0, occlusionTestTime = 0.0;
+	double cubeSubmitTime = 0.0;
+	unsigned int cubeDrawCalls = 0;
+	LightManager::UploadStats lightUpload;
+	// benchmark sweeps: every run renders SWEEP_FRAMES frames, the first SWEEP_WARMUP untimed
+	const unsigned int SWEEP_FRAMES = 12;
+	const unsigned int SWEEP_WARMUP = 4;
+	std::vector<SweepRun> sweepRuns;
+	std::size_t sweepRun = 0;
+	unsigned int sweepFrame = 0;
+	double sweepFrameTime = 0.0, sweepBuildTime = 0.0;
+	SweepRun sweepSaved{};
 	
 	while (!glfwWindowShouldClose(window))
 	{
@@ -239,105 +515,481 @@ int main()
 		// -----
 		processInput(window);
 		float current_time = static_cast<float>(glfwGetTime());
+		if ((lightSweepRequested || overdrawSweepRequested) && sweepRuns.empty())
+		{
+			// light count: 4 to 4096 point lights over the ten cubes, flat loop against clustered
+			for (std::size_t lights = 4; lightSweepRequested && lights <= 4096; lights *= 4)
+			{
+				sweepRuns.push_back({ lights, 10, false, false });
+				sweepRuns.push_back({ lights, 10, true, false });
+			}
+			// overdraw: ever more cubes drawn back to front, so forward shading lights every hidden layer
+			for (std::size_t cubes = 10; overdrawSweepRequested && cubes <= 10000; cubes *= 10)
+			{
+				for (std::size_t lights : { 64, 256 })
+				{
+					sweepRuns.push_back({ lights, cubes, false, false });
+					sweepRuns.push_back({ lights, cubes, true, false });
+					sweepRuns.push_back({ lights, cubes, false, true });
+				}
+			}
+			cubesBackToFront = overdrawSweepRequested;
+			sweepSaved = { swarmLights + SCENE_POINT_LIGHTS, sceneCubes, clusteredShading, deferredShading };
+			sweepRun = 0;
+			sweepFrame = 0;
+			sweepFrameTime = sweepBuildTime = 0.0;
+			std::cout << "Sweep: point lights, cubes, path, ms/frame, cluster build ms/frame" << std::endl;
+		}
+		lightSweepRequested = overdrawSweepRequested = false;
+		if (cullBenchmarkRequested)
+		{
+			runCullBenchmark(cubePositions, 10, cubeBox);
+			cullBenchmarkRequested = false;
+		}
+		if (!sweepRuns.empty())
+		{
+			swarmLights = sweepRuns[sweepRun].pointLights - SCENE_POINT_LIGHTS;
+			sceneCubes = sweepRuns[sweepRun].cubes;
+			clusteredShading = sweepRuns[sweepRun].clustered;
+			deferredShading = sweepRuns[sweepRun].deferred;
+		}
+		int framebufferWidth, framebufferHeight;
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
 		// render
 		// ------
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		frameRing.beginFrame();
 	
-		lightingShader.use();
-		lightingShader.setVec3("viewPos", camera.Position);
-		lightingShader.setFloat("material.shininess", 64.0f);
-
-		// directional light
-		lightingShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-		lightingShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-		lightingShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-		// point light 1
-		lightingShader.setVec3("pointLights[0].position", pointLightPositions[0]);
-		lightingShader.setVec3("pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[0].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[0].constant", 1.0f);
-		lightingShader.setFloat("pointLights[0].linear", 0.09f);
-		lightingShader.setFloat("pointLights[0].quadratic", 0.032f);
-		// point light 2
-		lightingShader.setVec3("pointLights[1].position", pointLightPositions[1]);
-		lightingShader.setVec3("pointLights[1].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[1].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[1].constant", 1.0f);
-		lightingShader.setFloat("pointLights[1].linear", 0.09f);
-		lightingShader.setFloat("pointLights[1].quadratic", 0.032f);
-		// point light 3
-		lightingShader.setVec3("pointLights[2].position", pointLightPositions[2]);
-		lightingShader.setVec3("pointLights[2].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[2].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[2].constant", 1.0f);
-		lightingShader.setFloat("pointLights[2].linear", 0.09f);
-		lightingShader.setFloat("pointLights[2].quadratic", 0.032f);
-		// point light 4
-		lightingShader.setVec3("pointLights[3].position", pointLightPositions[3]);
-		lightingShader.setVec3("pointLights[3].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[3].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[3].constant", 1.0f);
-		lightingShader.setFloat("pointLights[3].linear", 0.09f);
-		lightingShader.setFloat("pointLights[3].quadratic", 0.032f);
-		// spotLight
-		lightingShader.setVec3("spotLight.position", camera.Position);
-		lightingShader.setVec3("spotLight.direction", camera.Front);
-		lightingShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-		lightingShader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("spotLight.constant", 1.0f);
-		lightingShader.setFloat("spotLight.linear", 0.09f);
-		lightingShader.setFloat("spotLight.quadratic", 0.032f);
-		lightingShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-		lightingShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-
-		
-	
+		// switched off lights keep their place in the block with zero colour, so the uber-shader
+		// renders the same image as the variant that leaves them out
+		// a constant point light count only pays off for the handful of scene lights
+		// clustered shading replaces the point light loop, the uber-shader and the deferred path ignore it
+		const bool clustered = clusteredShading && !useUberShader && !deferredShading;
+		const bool dynamicPointLights = useUberShader || (swarmLights > 0 && !clustered);
+		const unsigned int pointLightFeature = clustered ? 0 : dynamicPointLights ? DYNAMIC_POINT_LIGHT_COUNT : activePointLights;
+		const std::uint32_t lightingFeatureSet = useUberShader ? LIGHTING_UBER_SHADER
+			: lightingFeatures(pointLightFeature, true, flashlightOn) | (clustered ? LIGHTING_CLUSTERED : 0u)
+			| (dirShadowsOn ? LIGHTING_DIR_SHADOWS : 0u) | (pointShadowsOn ? LIGHTING_POINT_SHADOWS : 0u);
+		const std::uint32_t cubeFeatureSet = lightingFeatureSet | (drawInstanced ? LIGHTING_INSTANCED : 0u);
+		// the deferred path draws the cubes into the G-buffer and lights them afterwards
+		const Shader& cubeShader = deferredShading ? gBufferVariants.get(drawInstanced ? LIGHTING_INSTANCED : 0u)
+			: lightingVariants.get(cubeFeatureSet);
+		const char* shadingPath = deferredShading ? "deferred" : clustered ? "clustered forward"
+			: useUberShader ? "uber-shader" : "specialised variant";
+		cubeShader.use();
+		// both are redundant after the first frame of a variant and skipped by the shadow copy
+		cubeShader.setInt("material.diffuse"_u, 0);
+		cubeShader.setInt("material.specular"_u, 1);
+		if (!deferredShading)
+		{
+			cubeShader.setFloat("material.shininess"_u, 64.0f);
+			if (pointLightFeature != 0 || clustered)
+			{
+				cubeShader.setInt("pointLightData"_u, 2);
+				if (cubeFeatureSet & LIGHTING_POINT_SHADOWS)
+				{
+					cubeShader.setInt("pointShadowData"_u, POINT_SHADOW_DATA_UNIT);
+					cubeShader.setInt("pointShadowAtlas"_u, POINT_SHADOW_ATLAS_UNIT);
+				}
+			}
+			if (dynamicPointLights)
+				cubeShader.setInt("pointLightCount"_u, (int)lightManager.pointLightCount());
+			if (cubeFeatureSet & LIGHTING_DIR_SHADOWS)
+				cubeShader.setInt("dirShadowMap"_u, SHADOW_MAP_UNIT);
+		}
+
+		flashlight.position = camera.Position;
+		flashlight.direction = camera.Front;
+		SpotLight frameFlashlight = flashlight;
+		if (!flashlightOn)
+			frameFlashlight.ambient = frameFlashlight.diffuse = frameFlashlight.specular = glm::vec3(0.0f);
+		lightManager.setSpotLight(frameFlashlight);
+		for (unsigned int i = 0; i < SCENE_POINT_LIGHTS && litPointLights != activePointLights; i++)
+		{
+			if ((i < activePointLights) != (i < litPointLights))
+				lightManager.setPointLight(i, scenePointLight(i, i < activePointLights));
+		}
+		litPointLights = activePointLights;
+		if (swarmOrigins.size() != swarmLights)
+		{
+			while (lightManager.pointLightCount() > SCENE_POINT_LIGHTS)
+				lightManager.removePointLight(lightManager.pointLightCount() - 1);
+			swarmOrigins.clear();
+			for (std::size_t i = 0; i < swarmLights; i++)
+			{
+				const float angle = i * 2.39996f; // golden angle spreads them evenly
+				const float radius = 1.0f + 6.0f * std::sqrt((float)i / swarmLights);
+				swarmOrigins.push_back(glm::vec3(radius * std::cos(angle), std::sin(i * 0.37f) * 3.0f, -6.0f + radius * std::sin(angle)));
+				PointLight light{};
+				light.position = swarmOrigins.back();
+				light.diffuse = glm::vec3(0.5f + 0.5f * std::sin(i * 0.1f), 0.5f + 0.5f * std::sin(i * 0.1f + 2.1f), 0.5f + 0.5f * std::sin(i * 0.1f + 4.2f)) * 0.3f;
+				light.specular = light.diffuse;
+				light.constant = 1.0f;
+				light.linear = 0.7f; // roughly 7 units of reach
+				light.quadratic = 1.8f;
+				if (lightManager.addPointLight(light) == lightManager.pointLightCount())
+				{
+					swarmOrigins.pop_back();
+					swarmLights = swarmOrigins.size(); // the rest don't fit, keep what did
+					break;
+				}
+			}
+		}
+		for (std::size_t moved = 0; moved < SWARM_MOVES_PER_FRAME && !swarmOrigins.empty(); moved++)
+		{
+			swarmCursor = (swarmCursor + 1) % swarmOrigins.size();
+			PointLight light = lightManager.pointLight(SCENE_POINT_LIGHTS + swarmCursor);
+			light.position = swarmOrigins[swarmCursor] + glm::vec3(0.0f, 0.5f * std::sin(currentFrame + swarmCursor), 0.0f);
+			lightManager.setPointLight(SCENE_POINT_LIGHTS + swarmCursor, light);
+		}
+		lightUpload = lightManager.upload();
+
 		// view/projection transformations
-		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		const float aspect = (float)SCR_WIDTH / (float)SCR_HEIGHT;
+		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), aspect, 0.1f, 100.0f);
 		glm::mat4 view = camera.GetViewMatrix();
-		lightingShader.setMat4("projection", projection);
-		lightingShader.setMat4("view", view);
-
-		glBindVertexArray(cubeVAO);
+		frameConstants.update(projection, view, camera.Position);
+		if (clustered)
+		{
+			const double clusterBuildStart = glfwGetTime();
+			clusterStats = lightClusters.build(lightManager, view, glm::radians(camera.Zoom), aspect, 0.1f, 100.0f);
+			clusterBuildTime = glfwGetTime() - clusterBuildStart;
+			cubeShader.setInt("clusterRanges"_u, 3);
+			cubeShader.setInt("clusterLightIndices"_u, 4);
+			cubeShader.setVec2("clusterTileSize"_u, glm::vec2((float)framebufferWidth / CLUSTER_GRID_X, (float)framebufferHeight / CLUSTER_GRID_Y));
+			cubeShader.setVec2("clusterDepthScaleBias"_u, lightClusters.depthScaleBias());
+		}
+		else
+		{
+			clusterBuildTime = 0.0;
+		}
 
-		// world transformation
-		glm::mat4 model = glm::mat4(1.0f);
-		lightingShader.setMat4("model", model);
+		if (cubeScene.size() != sceneCubes || cubeSceneBackToFront != cubesBackToFront)
+		{
+			cubeScene = generateCubeScene(cubePositions, 10, sceneCubes);
+			// the grid is generated front to back, reversed every cube lands on top of the last one
+			if (cubesBackToFront)
+				std::reverse(cubeScene.begin(), cubeScene.end());
+			cubeSceneBackToFront = cubesBackToFront;
+			cubeInstances.upload(cubeScene);
+			// new casters: every cascade has to be drawn again, and the BVH starts over
+			cubeBoxes.clear();
+			cubeBoxes.reserve(cubeScene.size());
+			glm::vec3 casterLower(std::numeric_limits<float>::max()), casterUpper(-std::numeric_limits<float>::max());
+			for (const CubeInstance& cube : cubeScene)
+			{
+				cubeBoxes.push_back(transformAabb(cubeBox, cube.model));
+				casterLower = glm::min(casterLower, cubeBoxes.back().lower);
+				casterUpper = glm::max(casterUpper, cubeBoxes.back().upper);
+			}
+			shadowCascades.setCasterBounds(casterLower, casterUpper);
+			pointShadows.invalidate();
+			cubeBvh.build(cubeBoxes);
+			drawnCubesStale = true;
+		}
+		// frustum culling: the lit pass only gets the cubes whose box touches the view frustum, in scene
+		// order since the overdraw sweep wants them back to front
+		if (frustumCulling)
+		{
+			const double cullStart = glfwGetTime();
+			cullStats = cubeBvh.cull(frustumFromMatrix(projection * view), visibleCubes);
+			std::sort(visibleCubes.begin(), visibleCubes.end());
+			cullTime = glfwGetTime() - cullStart;
+			occlusionTested = occludedCubes = 0;
+			if (occlusionCulling)
+			{
+				const double rasterStart = glfwGetTime();
+				occluderCandidates.clear();
+				for (std::uint32_t cube : visibleCubes)
+				{
+					const glm::vec3 offset = glm::vec3(cubeScene[cube].model[3]) - camera.Position;
+					occluderCandidates.emplace_back(glm::dot(offset, offset), cube);
+				}
+				const std::size_t occluders = std::min(OCCLUDER_CUBES, occluderCandidates.size());
+				std::partial_sort(occluderCandidates.begin(), occluderCandidates.begin() + occluders, occluderCandidates.end());
+				occluderModels.clear();
+				for (std::size_t i = 0; i < occluders; i++)
+					occluderModels.push_back(cubeScene[occluderCandidates[i].second].model);
+				occluderStats = occlusionCuller.rasterise(projection * view, cubeVertexPositions, occluderModels);
+				const double testStart = glfwGetTime();
+				occluderRasterTime = testStart - rasterStart;
+				occlusionTested = visibleCubes.size();
+				visibleCubes.erase(std::remove_if(visibleCubes.begin(), visibleCubes.end(),
+					[&](std::uint32_t cube) { return occlusionCuller.occluded(cubeBoxes[cube]); }), visibleCubes.end());
+				occludedCubes = occlusionTested - visibleCubes.size();
+				occlusionTestTime = glfwGetTime() - testStart;
+			}
+			if (drawnCubesStale || !drawnCubesCulled || visibleCubes != drawnCubeIndices)
+			{
+				culledCubes.clear();
+				for (std::uint32_t cube : visibleCubes)
+					culledCubes.push_back(cubeScene[cube]);
+				drawnCubeIndices = visibleCubes;
+				drawnCubeBufferCurrent = false;
+			}
+		}
+		else if (drawnCubesStale || drawnCubesCulled)
+		{
+			drawnCubeBufferCurrent = false;
+		}
+		drawnCubesCulled = frustumCulling;
+		drawnCubesStale = false;
+		const std::vector<CubeInstance>& drawnCubes = frustumCulling ? culledCubes : cubeScene;
+		// instanced, the culled list changes whenever the camera moves: it goes into this frame's ring
+		// region instead of reallocating a buffer. The unculled scene is uploaded once and kept.
+		FrameRingBuffer::Allocation streamedCubes;
+		if (drawInstanced && frustumCulling)
+			streamedCubes = frameRing.push(drawnCubes.data(), drawnCubes.size() * sizeof(CubeInstance), sizeof(glm::vec4));
+		glState.bindVertexArray(cubeVAO);
+		if (streamedCubes.valid())
+		{
+			CubeInstanceBuffer::attach(frameRing.id(), streamedCubes.offset);
+			drawnCubesStreamed = true;
+		}
+		else if (drawInstanced && (!drawnCubeBufferCurrent || drawnCubesStreamed))
+		{
+			if (!drawnCubeBufferCurrent)
+				drawnCubeInstances.upload(drawnCubes);
+			drawnCubeInstances.attach();
+			drawnCubeBufferCurrent = true;
+			drawnCubesStreamed = false;
+		}
+		// directional light shadows: the casters are drawn depth only, into the cascades that need it
+		shadowCascades.update(dirShadowsOn, dirLight.direction, view, glm::radians(camera.Zoom), aspect, 0.1f);
+		shadowCascadeRenders = 0;
+		if (dirShadowsOn)
+		{
+			shadowCascadeRenders = shadowCascades.render(shadowDepthShader, [&]()
+			{
+				glState.bindVertexArray(shadowCubeVAO);
+				glDrawArraysInstanced(GL_TRIANGLES, 0, 36, (GLsizei)cubeInstances.count);
+			}, framebufferWidth, framebufferHeight);
+		}
+		// point light shadows: six faces per light, only for the lights the budget picks this frame
+		const double pointShadowScheduleStart = glfwGetTime();
+		pointShadows.update(pointShadowsOn, lightManager, camera.Position, glm::radians(camera.Zoom));
+		pointShadowScheduleTime = glfwGetTime() - pointShadowScheduleStart;
+		pointShadows.render(shadowDepthShader, [&]()
+		{
+			glState.bindVertexArray(shadowCubeVAO);
+			glDrawArraysInstanced(GL_TRIANGLES, 0, 36, (GLsizei)cubeInstances.count);
+		}, framebufferWidth, framebufferHeight);
+		if (shadowCascadeRenders > 0 || pointShadows.stats().facesDrawn > 0)
+			cubeShader.use();
 
-		// render the cube
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		// the query about to be reused was issued LIT_PASS_QUERIES frames ago; a result still not there is dropped
+		litPassQuery = (litPassQuery + 1) % LIT_PASS_QUERIES;
+		if (litPassQueryPending[litPassQuery])
+		{
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(litPassQueries[litPassQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(litPassQueries[litPassQuery], GL_QUERY_RESULT, &elapsed);
+				litPassTime += elapsed * 1e-6;
+				litPassFrames++;
+			}
+		}
+		glBeginQuery(GL_TIME_ELAPSED, litPassQueries[litPassQuery]);
+		if (deferredShading)
+		{
+			deferredRenderer.resize(framebufferWidth, framebufferHeight);
+			deferredRenderer.beginGeometryPass();
+		}
 
-		for (unsigned int i = 0; i < 10; i++)
+		// render the cubes, timing only what the CPU spends submitting, sorting and drawing them
+		const double cubeSubmitStart = glfwGetTime();
+		renderQueue.clear();
+		const std::uint32_t cubeProgram = renderQueue.program(cubeShader);
+		const std::uint32_t cubeMaterial = renderQueue.material(containerMaterial);
+		const std::uint32_t cubeVao = renderQueue.vao(cubeVAO);
+		DrawItem cubeDraw;
+		cubeDraw.count = 36;
+		if (drawInstanced)
+		{
+			cubeDraw.instances = (GLsizei)drawnCubes.size();
+			renderQueue.submit(RENDER_PASS_OPAQUE, cubeProgram, cubeMaterial, cubeVao, 0.0f, cubeDraw);
+			cubeDrawCalls = 1;
+		}
+		else
+		{
+			for (const CubeInstance& cube : drawnCubes)
+			{
+				// front to back, except for the overdraw sweep which wants its back to front order kept
+				const float depth = cubesBackToFront ? 0.0f : glm::distance(glm::vec3(cube.model[3]), camera.Position) / 100.0f;
+				cubeDraw.model = &cube.model;
+				cubeDraw.normalMatrix = &cube.normalMatrix;
+				renderQueue.submit(RENDER_PASS_OPAQUE, cubeProgram, cubeMaterial, cubeVao, depth, cubeDraw);
+			}
+			cubeDrawCalls = (unsigned int)drawnCubes.size();
+		}
+		// we now draw as many light bulbs as we have point lights.
+		lampModels.clear();
+		for (unsigned int i = 0; i < activePointLights; i++)
 		{
 			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, cubePositions[i]);
-			model = glm::rotate(model, glm::radians(i * 20.0f), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			// render the cube
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+			model = glm::translate(model, pointLightPositions[i]);
+			model = glm::scale(model, glm::vec3(0.2f)); // Make it a smaller cube
+			lampModels.push_back(model);
 		}
+		const std::uint32_t lampProgram = renderQueue.program(lightCubeShader);
+		const std::uint32_t lampVao = renderQueue.vao(lightCubeVAO);
+		for (const glm::mat4& model : lampModels)
+		{
+			DrawItem lampDraw;
+			lampDraw.count = 36;
+			lampDraw.model = &model;
+			renderQueue.submit(RENDER_PASS_LAMPS, lampProgram, 0, lampVao, 0.0f, lampDraw);
+		}
+		const double sortStart = glfwGetTime();
+		renderQueue.sort();
+		renderQueueSortTime = glfwGetTime() - sortStart;
+		renderQueue.execute(RENDER_PASS_OPAQUE);
+		cubeSubmitTime = glfwGetTime() - cubeSubmitStart;
+
+		if (deferredShading)
+		{
+			// directional and spot light over the covered pixels, then every point light's volume
+			deferredRenderer.beginLightingPass();
+			const glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+			const Shader& fullscreenShader = deferredLightVariants.get(lightingFeatures(0, true, flashlightOn)
+				| (dirShadowsOn ? LIGHTING_DIR_SHADOWS : 0u));
+			const Shader& volumeShader = deferredLightVariants.get(lightingFeatures(DYNAMIC_POINT_LIGHT_COUNT, false, false)
+				| (pointShadowsOn ? LIGHTING_POINT_SHADOWS : 0u));
+			for (const Shader* shader : { &fullscreenShader, &volumeShader })
+			{
+				shader->use();
+				shader->setInt("gAlbedoSpecular"_u, GBUFFER_ALBEDO_SPECULAR_UNIT);
+				shader->setInt("gNormal"_u, GBUFFER_NORMAL_UNIT);
+				shader->setInt("gDepth"_u, GBUFFER_DEPTH_UNIT);
+				shader->setMat4("inverseViewProjection"_u, inverseViewProjection);
+				shader->setFloat("shininess"_u, 64.0f);
+			}
+			volumeShader.setInt("pointLightData"_u, 2);
+			if (pointShadowsOn)
+			{
+				volumeShader.setInt("pointShadowData"_u, POINT_SHADOW_DATA_UNIT);
+				volumeShader.setInt("pointShadowAtlas"_u, POINT_SHADOW_ATLAS_UNIT);
+			}
+			fullscreenShader.use();
+			if (dirShadowsOn)
+				fullscreenShader.setInt("dirShadowMap"_u, SHADOW_MAP_UNIT);
+			deferredRenderer.drawFullscreen();
+			volumeShader.use();
+			deferredRenderer.drawPointLightVolumes(lightManager.pointLightCount());
+			deferredRenderer.endLightingPass();
+		}
+
+		glEndQuery(GL_TIME_ELAPSED);
+		litPassQueryPending[litPassQuery] = true;
 
 		// also draw the lamp object(s)
-		lightCubeShader.use();
-		lightCubeShader.setMat4("projection", projection);
-		lightCubeShader.setMat4("view", view);
+		renderQueue.execute(RENDER_PASS_LAMPS);
+		if (deferredShading)
+			deferredRenderer.present();
+		frameRing.endFrame();
+#ifndef NDEBUG
+		// debug builds read everything the state cache believes back from GL once a frame
+		glState.verify();
+#endif
 
-		// we now draw as many light bulbs as we have point lights.
-		glBindVertexArray(lightCubeVAO);
-		for (unsigned int i = 0; i < 4; i++)
+		if (currentFrame - lastStatsReport >= 1.0f)
 		{
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, pointLightPositions[i]);
-			model = glm::scale(model, glm::vec3(0.2f)); // Make it a smaller cube
-			lightCubeShader.setMat4("model", model);
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+			const UniformStats lighting = cubeShader.uniformStats();
+			const UniformStats lightCube = lightCubeShader.uniformStats();
+			std::cout << "Uniform updates this frame: " << lighting.misses + lightCube.misses << " sent, "
+				<< lighting.hits + lightCube.hits << " skipped as redundant" << std::endl;
+			std::cout << "GL state this frame: " << glState.stats().issued << " binds and switches sent, "
+				<< glState.stats().elided << " skipped as redundant" << std::endl;
+			std::cout << "Lit pass: " << (litPassFrames > 0 ? litPassTime / litPassFrames : 0.0) << " ms GPU, "
+				<< shadingPath << ", " << activePointLights << " point lights, flashlight "
+				<< (flashlightOn ? "on" : "off") << " (" << lightingVariants.size() << " variants compiled)" << std::endl;
+			if (deferredShading)
+				std::cout << "G-buffer: " << framebufferWidth << "x" << framebufferHeight << ", " << DeferredRenderer::bytesPerPixel()
+					<< " bytes per pixel, " << deferredLightVariants.size() + gBufferVariants.size() << " deferred programs compiled" << std::endl;
+			std::cout << "Cubes: " << cubeScene.size() << " in " << cubeDrawCalls << " draw calls ("
+				<< (drawInstanced ? "instanced" : "one per cube") << "), " << cubeSubmitTime * 1000.0 << " ms CPU to submit" << std::endl;
+			const RenderQueue::StateStats& sorted = renderQueue.executedStats();
+			const RenderQueue::StateStats& submitted = renderQueue.submissionOrderStats();
+			std::cout << "Render queue: " << renderQueue.size() << " draws sorted in " << renderQueueSortTime * 1000.0 << " ms, "
+				<< sorted.programBinds << " program, " << sorted.textureBinds << " texture and " << sorted.vaoBinds << " VAO binds against "
+				<< submitted.programBinds << ", " << submitted.textureBinds << " and " << submitted.vaoBinds << " in submission order" << std::endl;
+			if (frustumCulling)
+				std::cout << "Frustum culling: " << cullStats.visible << " of " << cullStats.objects << " cubes in view, "
+					<< cullStats.objects - cullStats.visible << " rejected, " << cullStats.nodesTested << " of " << cubeBvh.nodeCount()
+					<< " BVH nodes tested in " << cullTime * 1000.0 << " ms CPU" << std::endl;
+			if (frustumCulling && occlusionCulling)
+				std::cout << "Occlusion culling: " << occluderStats.occluders << " occluders (" << occluderStats.triangles << " triangles) rasterised in "
+					<< occluderRasterTime * 1000.0 << " ms on " << occluderStats.threads << " threads, " << occlusionTested << " cubes tested in "
+					<< occlusionTestTime * 1000.0 << " ms, " << occludedCubes << " hidden (draw calls saved one per cube, instances when instanced)" << std::endl;
+			std::cout << "Point lights: " << lightManager.pointLightCount() << ", last upload sent " << lightUpload.pointLights
+				<< " of them in " << lightUpload.ranges << " ranges (" << lightUpload.bytes << " bytes)" << std::endl;
+			if (dirShadowsOn)
+			{
+				std::cout << "Shadow cascades (split depth, renders, last render ms GPU):";
+				for (unsigned int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+				{
+					const ShadowCascades::CascadeStats& cascade = shadowCascades.stats()[i];
+					std::cout << " [" << cascade.splitDepth << ", " << cascade.renders << ", " << cascade.lastRenderTime << "]";
+				}
+				std::cout << ", " << shadowCascadeRenders << " drawn this frame" << std::endl;
+			}
+			if (pointShadowsOn)
+			{
+				const PointShadowAtlas::Stats& shadowStats = pointShadows.stats();
+				std::cout << "Point light shadows: ";
+				for (unsigned int tier = 0; tier < PointShadowAtlas::TIER_COUNT; tier++)
+					std::cout << shadowStats.shadowed[tier] << " at " << PointShadowAtlas::TIERS[tier].faceSize << (tier + 1 < PointShadowAtlas::TIER_COUNT ? " px, " : " px");
+				std::cout << "; " << shadowStats.lightsDrawn << " lights (" << shadowStats.facesDrawn << " faces) drawn this frame, "
+					<< shadowStats.waiting << " waiting, " << pointShadowScheduleTime * 1000.0 << " ms CPU to schedule, last draw "
+					<< shadowStats.lastRenderTime << " ms GPU" << std::endl;
+			}
+			const FrameRingBuffer::Stats& ringStats = frameRing.stats();
+			std::cout << "Frame ring: " << (frameRing.persistentlyMapped() ? "persistently mapped" : "mapped unsynchronised per push")
+				<< ", up to " << ringStats.peakBytes / 1024.0 << " of " << frameRing.capacity() / 1024 << " KB a frame, " << ringStats.overflows
+				<< " pushes too large, " << ringStats.mapFailures << " failed to map, " << ringStats.stalls << " stalls on the GPU over " << ringStats.frames << " frames ("
+				<< ringStats.stallTime * 1000.0 << " ms waiting)" << std::endl;
+			frameRing.resetStats();
+			if (clustered)
+				std::cout << "Clusters: " << clusterStats.visibleLights << " of " << clusterStats.lights << " point lights in view, "
+					<< clusterStats.indices << " light indices (" << (double)clusterStats.indices / LightClusters::CLUSTER_COUNT
+					<< " per cluster), built in " << clusterBuildTime * 1000.0 << " ms on " << clusterStats.threads << " threads" << std::endl;
+			litPassTime = 0.0;
+			litPassFrames = 0;
+			lastStatsReport = currentFrame;
+		}
+		cubeShader.resetUniformStats();
+		lightCubeShader.resetUniformStats();
+		glState.resetStats();
+
+		if (!sweepRuns.empty())
+		{
+			// wait for the GPU so the frame time covers the shading, not just the submission
+			glFinish();
+			if (++sweepFrame > SWEEP_WARMUP)
+			{
+				sweepFrameTime += glfwGetTime() - currentFrame;
+				sweepBuildTime += clusterBuildTime;
+			}
+			if (sweepFrame == SWEEP_FRAMES)
+			{
+				const double frames = SWEEP_FRAMES - SWEEP_WARMUP;
+				std::cout << "  " << lightManager.pointLightCount() << ", " << cubeScene.size() << ", " << shadingPath << ", "
+					<< sweepFrameTime / frames * 1000.0 << ", " << sweepBuildTime / frames * 1000.0 << std::endl;
+				sweepFrame = 0;
+				sweepFrameTime = sweepBuildTime = 0.0;
+				if (++sweepRun == sweepRuns.size())
+				{
+					sweepRuns.clear();
+					swarmLights = sweepSaved.pointLights - SCENE_POINT_LIGHTS;
+					sceneCubes = sweepSaved.cubes;
+					clusteredShading = sweepSaved.clustered;
+					deferredShading = sweepSaved.deferred;
+					cubesBackToFront = false;
+				}
+			}
 		}
 
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -348,9 +1000,20 @@ int main()
 
 	// optional: de-allocate all resources once they've outlived their purpose:
 	// ------------------------------------------------------------------------
-	glDeleteVertexArrays(1, &cubeVAO);
-	glDeleteVertexArrays(1, &lightCubeVAO);
-	glDeleteBuffers(1, &VBO);
+	glState.deleteVertexArrays(1, &cubeVAO);
+	glState.deleteVertexArrays(1, &lightCubeVAO);
+	glState.deleteVertexArrays(1, &shadowCubeVAO);
+	glState.deleteBuffers(1, &VBO);
+	glState.deleteBuffers(1, &shadowVBO);
+	glState.deleteBuffers(1, &cubeInstances.VBO);
+	glState.deleteBuffers(1, &drawnCubeInstances.VBO);
+	frameRing.release();
+	lightManager.release();
+	lightClusters.release();
+	deferredRenderer.release();
+	shadowCascades.release();
+	pointShadows.release();
+	glDeleteQueries(LIT_PASS_QUERIES, litPassQueries);
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
@@ -377,6 +1040,65 @@ void processInput(GLFWwindow* window)
 		camera.ProcessKeyboard(LEFT, deltaTime);
 	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
 		camera.ProcessKeyboard(RIGHT, deltaTime);
+
+	for (unsigned int count = 0; count <= SCENE_POINT_LIGHTS; count++)
+	{
+		if (glfwGetKey(window, GLFW_KEY_0 + (int)count) == GLFW_PRESS)
+			activePointLights = count;
+	}
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
+		flashlightOn = true;
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS)
+		flashlightOn = false;
+	if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS)
+		useUberShader = true;
+	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
+		useUberShader = false;
+
+	std::size_t cubes = 10;
+	for (int key = GLFW_KEY_F1; key <= GLFW_KEY_F6; key++, cubes *= 10)
+	{
+		if (glfwGetKey(window, key) == GLFW_PRESS)
+			sceneCubes = cubes;
+	}
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
+		drawInstanced = true;
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
+		drawInstanced = false;
+	if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
+		swarmLights = SWARM_LIGHTS;
+	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
+		swarmLights = 0;
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS)
+		clusteredShading = true;
+	if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS)
+		clusteredShading = false;
+	if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
+		deferredShading = true;
+	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
+		deferredShading = false;
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS)
+		lightSweepRequested = true;
+	if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS)
+		overdrawSweepRequested = true;
+	if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS)
+		dirShadowsOn = true;
+	if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS)
+		dirShadowsOn = false;
+	if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS)
+		pointShadowsOn = true;
+	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS)
+		pointShadowsOn = false;
+	if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS)
+		frustumCulling = true;
+	if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS)
+		frustumCulling = false;
+	if (glfwGetKey(window, GLFW_KEY_F7) == GLFW_PRESS)
+		cullBenchmarkRequested = true;
+	if (glfwGetKey(window, GLFW_KEY_F8) == GLFW_PRESS)
+		occlusionCulling = true;
+	if (glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS)
+		occlusionCulling = false;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -0,0 +1,241 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm/glm.hpp>
+#include "scene_bvh.h"
+#include "worker_pool.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_CULLER_SSE
+#endif
+
+// Software occlusion culling, entirely on the CPU and without a GL context. rasterise() draws a
+// few large occluders into a WIDTH x HEIGHT depth buffer, occluded() then checks an object's screen
+// rectangle against it and reports whether something nearer covers all of it.
+// The rasteriser works four pixels at a time with SSE on horizontal bands of the buffer, spread
+// over the threads of a WorkerPool, and keeps the largest depth of every TILE x TILE block next to it so most
+// tests settle per block instead of per pixel. It is conservative where it matters: a pixel only
+// takes an occluder's depth when one triangle covers all of it, so a crack between occluders
+// narrower than a pixel still leaves that pixel far; the depth it takes is the furthest the
+// triangle has anywhere in it; the tested rectangle grows by a pixel on each side; and anything
+// crossing the near plane counts as visible. The price is that pixels on the edges shared by an
+// occluder's own triangles stay uncovered too, so boxes overlapping them are kept.
+// Depth is window depth, 0 at the near plane and 1 at the far one, the buffer keeps the nearest.
+class OcclusionCuller
+{
+public:
+	static constexpr int WIDTH = 256;
+	static constexpr int HEIGHT = 128;
+	static constexpr int TILE = 8;
+	static constexpr int TILES_X = WIDTH / TILE;
+	static constexpr int TILES_Y = HEIGHT / TILE;
+	// rows of a band, each worker takes whole bands
+	static constexpr int BAND_ROWS = 16;
+
+	struct RasterStats
+	{
+		std::size_t occluders = 0;
+		std::size_t triangles = 0; // in front of the near plane and on screen
+		unsigned int threads = 0;
+	};
+
+	explicit OcclusionCuller(WorkerPool& pool) : depth(WIDTH * HEIGHT), tileMax(TILES_X * TILES_Y), pool(pool) {}
+
+	// clear and draw the occluders: every model matrix places one copy of the triangle list
+	// modelTriangles, three model space positions per triangle in either winding
+	// ------------------------------------------------------------------------
+	RasterStats rasterise(const glm::mat4& viewProjection, const std::vector<glm::vec3>& modelTriangles, const std::vector<glm::mat4>& occluderModels)
+	{
+		this->viewProjection = viewProjection;
+		triangles.clear();
+		for (const glm::mat4& model : occluderModels)
+		{
+			const glm::mat4 transform = viewProjection * model;
+			for (std::size_t i = 0; i + 2 < modelTriangles.size(); i += 3)
+				setupTriangle(transform * glm::vec4(modelTriangles[i], 1.0f), transform * glm::vec4(modelTriangles[i + 1], 1.0f),
+					transform * glm::vec4(modelTriangles[i + 2], 1.0f));
+		}
+
+		const unsigned int bands = HEIGHT / BAND_ROWS;
+		const unsigned int threadCount = std::min(pool.size(), bands);
+		auto work = [this, bands, threadCount](unsigned int t)
+		{
+			for (unsigned int band = t; band < bands; band += threadCount)
+				rasteriseBand((int)band * BAND_ROWS, (int)(band + 1) * BAND_ROWS);
+		};
+		pool.run(threadCount, work);
+
+		RasterStats stats;
+		stats.occluders = occluderModels.size();
+		stats.triangles = triangles.size();
+		stats.threads = threadCount;
+		return stats;
+	}
+	// true when the box is hidden behind the occluders of the last rasterise()
+	// ------------------------------------------------------------------------
+	bool occluded(const Aabb& box) const
+	{
+		glm::vec2 lower(std::numeric_limits<float>::max()), upper(-std::numeric_limits<float>::max());
+		float nearest = std::numeric_limits<float>::max();
+		for (int corner = 0; corner < 8; corner++)
+		{
+			const glm::vec4 clip = viewProjection * glm::vec4(corner & 1 ? box.upper.x : box.lower.x,
+				corner & 2 ? box.upper.y : box.lower.y, corner & 4 ? box.upper.z : box.lower.z, 1.0f);
+			if (clip.w < NEAR_W)
+				return false;
+			const glm::vec3 window = toWindow(clip);
+			lower = glm::min(lower, glm::vec2(window));
+			upper = glm::max(upper, glm::vec2(window));
+			nearest = std::min(nearest, window.z);
+		}
+		const int x0 = std::max((int)std::floor(lower.x) - 1, 0), x1 = std::min((int)std::floor(upper.x) + 1, WIDTH - 1);
+		const int y0 = std::max((int)std::floor(lower.y) - 1, 0), y1 = std::min((int)std::floor(upper.y) + 1, HEIGHT - 1);
+		// off screen is the frustum culler's business
+		if (x0 > x1 || y0 > y1)
+			return false;
+		for (int tileY = y0 / TILE; tileY <= y1 / TILE; tileY++)
+		{
+			for (int tileX = x0 / TILE; tileX <= x1 / TILE; tileX++)
+			{
+				if (tileMax[tileY * TILES_X + tileX] < nearest)
+					continue;
+				// the block has something at or behind the box, look at the pixels the rectangle covers
+				for (int y = std::max(y0, tileY * TILE); y <= std::min(y1, tileY * TILE + TILE - 1); y++)
+				{
+					for (int x = std::max(x0, tileX * TILE); x <= std::min(x1, tileX * TILE + TILE - 1); x++)
+					{
+						if (depth[y * WIDTH + x] >= nearest)
+							return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+	// the buffer, row 0 at the bottom, for looking at it
+	const std::vector<float>& depthBuffer() const { return depth; }
+
+private:
+	// clip w below which a vertex counts as crossing the near plane
+	static constexpr float NEAR_W = 1e-3f;
+
+	// a triangle ready to scan: edge functions a*x + b*y + c >= 0 inside, depth plane z = zx*x + zy*y + z0
+	struct Triangle
+	{
+		float a[3], b[3], c[3];
+		float zx, zy, z0;
+		int minX, maxX, minY, maxY;
+	};
+	std::vector<float> depth;
+	std::vector<float> tileMax;
+	std::vector<Triangle> triangles;
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	WorkerPool& pool;
+
+	static glm::vec3 toWindow(const glm::vec4& clip)
+	{
+		const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		return glm::vec3((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT, ndc.z * 0.5f + 0.5f);
+	}
+	void setupTriangle(const glm::vec4& clip0, const glm::vec4& clip1, const glm::vec4& clip2)
+	{
+		// an occluder only has to be right where it is drawn, leaving out what crosses the near plane is safe
+		if (clip0.w < NEAR_W || clip1.w < NEAR_W || clip2.w < NEAR_W)
+			return;
+		glm::vec3 v[3] = { toWindow(clip0), toWindow(clip1), toWindow(clip2) };
+		float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+		if (area == 0.0f)
+			return;
+		// the tutorial's cube mixes windings, so both sides are drawn; counter-clockwise from here on
+		if (area < 0.0f)
+		{
+			std::swap(v[1], v[2]);
+			area = -area;
+		}
+		Triangle triangle;
+		triangle.minX = std::max((int)std::floor(std::min({ v[0].x, v[1].x, v[2].x })), 0);
+		triangle.maxX = std::min((int)std::ceil(std::max({ v[0].x, v[1].x, v[2].x })), WIDTH - 1);
+		triangle.minY = std::max((int)std::floor(std::min({ v[0].y, v[1].y, v[2].y })), 0);
+		triangle.maxY = std::min((int)std::ceil(std::max({ v[0].y, v[1].y, v[2].y })), HEIGHT - 1);
+		if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+			return;
+		for (int edge = 0; edge < 3; edge++)
+		{
+			const glm::vec3& from = v[edge];
+			const glm::vec3& to = v[(edge + 1) % 3];
+			triangle.a[edge] = from.y - to.y;
+			triangle.b[edge] = to.x - from.x;
+			// tested at pixel centres: move the edge inwards by half a pixel's extent along its normal
+			// so a centre only passes when the whole pixel is inside
+			triangle.c[edge] = -(triangle.a[edge] * from.x + triangle.b[edge] * from.y)
+				- 0.5f * (std::abs(triangle.a[edge]) + std::abs(triangle.b[edge]));
+		}
+		// window depth is linear in window x and y; a pixel gets the furthest depth anywhere in it
+		triangle.zx = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+		triangle.zy = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+		triangle.z0 = v[0].z - triangle.zx * v[0].x - triangle.zy * v[0].y + 0.5f * (std::abs(triangle.zx) + std::abs(triangle.zy));
+		triangles.push_back(triangle);
+	}
+	// clear rows [rowBegin, rowEnd), draw every triangle into them and update their blocks' maxima
+	void rasteriseBand(int rowBegin, int rowEnd)
+	{
+		std::fill(depth.begin() + rowBegin * WIDTH, depth.begin() + rowEnd * WIDTH, 1.0f);
+		for (const Triangle& triangle : triangles)
+		{
+			const int y0 = std::max(triangle.minY, rowBegin), y1 = std::min(triangle.maxY, rowEnd - 1);
+			// whole groups of four, the buffer width is a multiple of four
+			const int x0 = triangle.minX & ~3, x1 = triangle.maxX | 3;
+			for (int y = y0; y <= y1; y++)
+			{
+				const float py = y + 0.5f;
+				float* row = &depth[y * WIDTH];
+#ifdef OCCLUSION_CULLER_SSE
+				const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+				const __m128 zero = _mm_setzero_ps();
+				for (int x = x0; x <= x1; x += 4)
+				{
+					const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+					__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+					for (int edge = 0; edge < 3; edge++)
+					{
+						const __m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.a[edge]), px), _mm_set1_ps(triangle.b[edge] * py + triangle.c[edge]));
+						inside = _mm_and_ps(inside, _mm_cmpge_ps(e, zero));
+					}
+					const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.zx), px), _mm_set1_ps(triangle.zy * py + triangle.z0));
+					const __m128 old = _mm_loadu_ps(row + x);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(old, z)), _mm_andnot_ps(inside, old)));
+				}
+#else
+				for (int x = x0; x <= x1; x++)
+				{
+					const float px = x + 0.5f;
+					bool inside = true;
+					for (int edge = 0; edge < 3; edge++)
+						inside = inside && triangle.a[edge] * px + triangle.b[edge] * py + triangle.c[edge] >= 0.0f;
+					if (inside)
+						row[x] = std::min(row[x], triangle.zx * px + triangle.zy * py + triangle.z0);
+				}
+#endif
+			}
+		}
+		for (int tileY = rowBegin / TILE; tileY < rowEnd / TILE; tileY++)
+		{
+			for (int tileX = 0; tileX < TILES_X; tileX++)
+			{
+				float furthest = 0.0f;
+				for (int y = tileY * TILE; y < tileY * TILE + TILE; y++)
+					furthest = std::max(furthest, *std::max_element(&depth[y * WIDTH + tileX * TILE], &depth[y * WIDTH + tileX * TILE] + TILE));
+				tileMax[tileY * TILES_X + tileX] = furthest;
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,400 @@
+#ifndef POINT_SHADOW_ATLAS_H
+#define POINT_SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "gl_state_cache.h"
+#include "shaders.h"
+#include "light_manager.h"
+#include "light_clusters.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <iostream>
+#include <algorithm>
+
+// texture units of the atlas and its per-light texture buffer, after the shadow cascades' 8
+const unsigned int POINT_SHADOW_ATLAS_UNIT = 9;
+const unsigned int POINT_SHADOW_DATA_UNIT = 10;
+
+// Omnidirectional shadows for the point lights, all of them in one depth texture. The atlas is a
+// grid of 256 pixel cells and every shadowed light takes six square tiles, one per cube face, in
+// one of three resolution tiers (see the keep-in-sync copy in basic_lighting_obj.glslf):
+//   tier 0: 256 px faces in cells 0-23, 4 lights,
+//   tier 1: 128 px faces in cells 24-47, 16 lights,
+//   tier 2: 64 px faces in cells 48-63, 42 lights.
+// update() ranks the lights by how much of the screen their sphere of influence covers and gives
+// the closest ones the sharpest tier that still has room; the rest are not shadowed. A light only
+// needs drawing when it got a new tile, moved, changed reach or the casters changed, and of those
+// at most MAX_FACES_PER_FRAME faces and MAX_TEXELS_PER_FRAME texels are drawn per frame, the largest
+// and longest waiting first. The others keep the map they have, which the shader reads from where
+// it was drawn, so a moving light's shadow lags a few frames instead of the frame time growing six
+// draws per light.
+// The shader finds everything in a texture buffer, two RGBA32F texels per point light:
+//   (position the map was drawn from, far plane), (tier or -1 when unshadowed, slot in the tier, 0, 0).
+class PointShadowAtlas
+{
+public:
+	static constexpr GLsizei ATLAS_SIZE = 2048;
+	static constexpr GLsizei CELL_SIZE = 256;
+	static constexpr unsigned int CELLS_PER_ROW = ATLAS_SIZE / CELL_SIZE;
+	static constexpr unsigned int TIER_COUNT = 3;
+	static constexpr float NEAR_PLANE = 0.05f;
+	static constexpr unsigned int MAX_FACES_PER_FRAME = 24;
+	static constexpr std::size_t MAX_TEXELS_PER_FRAME = 2 * 6 * CELL_SIZE * CELL_SIZE;
+
+	struct Tier
+	{
+		GLsizei faceSize;
+		unsigned int firstCell;
+		unsigned int cells;
+		float maxDistance; // lights further from the camera start at a coarser tier
+	};
+	static constexpr Tier TIERS[TIER_COUNT] = {
+		{ 256, 0, 24, 8.0f },
+		{ 128, 24, 24, 20.0f },
+		{ 64, 48, 16, std::numeric_limits<float>::max() },
+	};
+
+	struct Stats
+	{
+		std::size_t shadowed[TIER_COUNT] = {};
+		std::size_t waiting = 0; // lights whose map is missing or out of date after this frame
+		unsigned int lightsDrawn = 0;
+		unsigned int facesDrawn = 0;
+		double lastRenderTime = 0.0; // GPU milliseconds of the last frame that drew anything
+	};
+
+	PointShadowAtlas()
+	{
+		// both stay bound to their units for the whole run, nothing else uses them
+		glGenTextures(1, &atlas);
+		glState.activeTexture(GL_TEXTURE0 + POINT_SHADOW_ATLAS_UNIT);
+		glState.bindTexture(GL_TEXTURE_2D, atlas);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, ATLAS_SIZE, ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		glGenBuffers(1, &dataBuffer);
+		glGenTextures(1, &dataTexture);
+		reserve(64);
+		glState.activeTexture(GL_TEXTURE0 + POINT_SHADOW_DATA_UNIT);
+		glState.bindTexture(GL_TEXTURE_BUFFER, dataTexture);
+		glState.activeTexture(GL_TEXTURE0);
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, atlas, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::FRAMEBUFFER::POINT_SHADOW_ATLAS_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glGenQueries(QUERIES, queries);
+
+		for (unsigned int tier = 0; tier < TIER_COUNT; tier++)
+		{
+			const unsigned int faces = TIERS[tier].cells * (CELL_SIZE / TIERS[tier].faceSize) * (CELL_SIZE / TIERS[tier].faceSize);
+			slotOwners[tier].assign(faces / 6, NO_LIGHT);
+		}
+	}
+	// free the GL objects, call before the context goes away
+	// ------------------------------------------------------------------------
+	void release()
+	{
+		glState.deleteTextures(1, &atlas);
+		glState.deleteTextures(1, &dataTexture);
+		glState.deleteBuffers(1, &dataBuffer);
+		glDeleteFramebuffers(1, &FBO);
+		glDeleteQueries(QUERIES, queries);
+	}
+
+	// the shadow casters changed, every map has to be drawn again
+	// ------------------------------------------------------------------------
+	void invalidate()
+	{
+		for (LightShadow& shadow : shadows)
+			shadow.current = false;
+	}
+	// hand out the tiles and pick this frame's lights to draw; with enabled false the shader sees
+	// every light as unshadowed and nothing is drawn, the maps are kept for when it comes back on
+	// ------------------------------------------------------------------------
+	void update(bool enabled, const LightManager& lights, const glm::vec3& cameraPosition, float fovY)
+	{
+		const std::size_t count = lights.pointLightCount();
+		if (shadows.size() > count)
+		{
+			for (std::size_t i = count; i < shadows.size(); i++)
+				releaseSlot(shadows[i]);
+		}
+		shadows.resize(count);
+		dataDirty |= enabled != wasEnabled;
+		wasEnabled = enabled;
+		scheduled.clear();
+		if (!enabled)
+			return;
+
+		// the screen height fraction the sphere of influence spans, squared; 1 when the camera is inside
+		const float tanHalfFovY = std::tan(fovY * 0.5f);
+		order.clear();
+		for (std::size_t i = 0; i < count; i++)
+		{
+			LightShadow& shadow = shadows[i];
+			const PointLight& light = lights.pointLight(i);
+			shadow.position = light.position;
+			shadow.radius = std::min(pointLightRadius(light), 1.0e4f);
+			const float distance = glm::length(light.position - cameraPosition);
+			const float extent = distance <= shadow.radius ? 1.0f : shadow.radius / (distance * tanHalfFovY);
+			shadow.coverage = std::min(extent * extent, 1.0f);
+			shadow.desiredTier = 0;
+			while (shadow.desiredTier + 1 < TIER_COUNT && distance > TIERS[shadow.desiredTier].maxDistance)
+				shadow.desiredTier++;
+			if (shadow.radius > NEAR_PLANE)
+				order.push_back(i);
+		}
+		std::sort(order.begin(), order.end(), [&](std::size_t lhs, std::size_t rhs) { return shadows[lhs].coverage > shadows[rhs].coverage; });
+
+		// the biggest lights get the sharpest tier with room left, from their distance tier down
+		std::size_t room[TIER_COUNT];
+		for (unsigned int tier = 0; tier < TIER_COUNT; tier++)
+			room[tier] = slotOwners[tier].size();
+		for (LightShadow& shadow : shadows)
+			shadow.assignedTier = NO_TIER;
+		for (std::size_t i : order)
+		{
+			for (unsigned int tier = shadows[i].desiredTier; tier < TIER_COUNT; tier++)
+			{
+				if (room[tier] > 0)
+				{
+					room[tier]--;
+					shadows[i].assignedTier = (int)tier;
+					break;
+				}
+			}
+		}
+		// moving tiers frees the old tile first, then the newcomers take what is free
+		for (LightShadow& shadow : shadows)
+		{
+			if (shadow.tier != shadow.assignedTier)
+				releaseSlot(shadow);
+		}
+		for (std::size_t i : order)
+		{
+			LightShadow& shadow = shadows[i];
+			if (shadow.tier == NO_TIER && shadow.assignedTier != NO_TIER)
+			{
+				std::vector<std::size_t>& owners = slotOwners[shadow.assignedTier];
+				shadow.slot = (unsigned int)(std::find(owners.begin(), owners.end(), NO_LIGHT) - owners.begin());
+				owners[shadow.slot] = i;
+				shadow.tier = shadow.assignedTier;
+				shadow.current = false;
+				shadow.drawn = false;
+				dataDirty = true;
+			}
+		}
+
+		// out of date maps, the largest and longest waiting first, as many as the budget takes
+		stats_.waiting = 0;
+		for (std::size_t i : order)
+		{
+			LightShadow& shadow = shadows[i];
+			if (shadow.tier == NO_TIER)
+				continue;
+			if (shadow.drawn && (shadow.position != shadow.drawnPosition || shadow.radius != shadow.drawnRadius))
+				shadow.current = false;
+			if (!shadow.current)
+				scheduled.push_back(i);
+		}
+		std::stable_sort(scheduled.begin(), scheduled.end(), [&](std::size_t lhs, std::size_t rhs)
+			{ return shadows[lhs].coverage * (1 + shadows[lhs].framesWaiting) > shadows[rhs].coverage * (1 + shadows[rhs].framesWaiting); });
+		std::size_t faces = 0, texels = 0, kept = 0;
+		for (std::size_t i : scheduled)
+		{
+			const std::size_t faceSize = TIERS[shadows[i].tier].faceSize;
+			if (faces + 6 <= MAX_FACES_PER_FRAME && texels + 6 * faceSize * faceSize <= MAX_TEXELS_PER_FRAME)
+			{
+				faces += 6;
+				texels += 6 * faceSize * faceSize;
+				scheduled[kept++] = i;
+			}
+			else
+			{
+				shadows[i].framesWaiting++;
+				stats_.waiting++;
+			}
+		}
+		scheduled.resize(kept);
+		for (unsigned int tier = 0; tier < TIER_COUNT; tier++)
+			stats_.shadowed[tier] = slotOwners[tier].size() - room[tier];
+	}
+	// draw the six faces of every light update() picked; drawCasters() issues the depth-only draws
+	// with depthShader bound, which gets the face's matrix as lightViewProjection. The viewport is
+	// set back to the framebuffer size afterwards.
+	// ------------------------------------------------------------------------
+	template <typename DrawCasters>
+	void render(const Shader& depthShader, DrawCasters&& drawCasters, int framebufferWidth, int framebufferHeight)
+	{
+		collectTimings();
+		stats_.lightsDrawn = (unsigned int)scheduled.size();
+		stats_.facesDrawn = 0;
+		if (!scheduled.empty())
+		{
+			// the cube map convention: looking down each axis with these up vectors
+			static const glm::vec3 FACE_DIRECTIONS[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+			static const glm::vec3 FACE_UPS[6] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+			// with every query of the ring still waiting on the GPU this frame goes untimed
+			const bool timed = !queryPending[nextQuery];
+			if (timed)
+				glBeginQuery(GL_TIME_ELAPSED, queries[nextQuery]);
+			glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+			glState.enable(GL_SCISSOR_TEST);
+			glState.enable(GL_POLYGON_OFFSET_FILL);
+			glPolygonOffset(2.0f, 4.0f);
+			depthShader.use();
+			for (std::size_t i : scheduled)
+			{
+				LightShadow& shadow = shadows[i];
+				const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, NEAR_PLANE, shadow.radius);
+				const GLsizei faceSize = TIERS[shadow.tier].faceSize;
+				for (unsigned int face = 0; face < 6; face++)
+				{
+					const glm::ivec2 origin = faceOrigin(shadow.tier, shadow.slot, face);
+					glViewport(origin.x, origin.y, faceSize, faceSize);
+					glScissor(origin.x, origin.y, faceSize, faceSize);
+					glClear(GL_DEPTH_BUFFER_BIT);
+					depthShader.setMat4("lightViewProjection"_u,
+						projection * glm::lookAt(shadow.position, shadow.position + FACE_DIRECTIONS[face], FACE_UPS[face]));
+					drawCasters();
+					stats_.facesDrawn++;
+				}
+				shadow.current = shadow.drawn = true;
+				shadow.drawnPosition = shadow.position;
+				shadow.drawnRadius = shadow.radius;
+				shadow.framesWaiting = 0;
+				dataDirty = true;
+			}
+			glState.disable(GL_POLYGON_OFFSET_FILL);
+			glState.disable(GL_SCISSOR_TEST);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glViewport(0, 0, framebufferWidth, framebufferHeight);
+			if (timed)
+			{
+				glEndQuery(GL_TIME_ELAPSED);
+				queryPending[nextQuery] = true;
+				nextQuery = (nextQuery + 1) % QUERIES;
+			}
+		}
+		if (dataDirty)
+			uploadData();
+	}
+	const Stats& stats() const { return stats_; }
+
+private:
+	static constexpr int NO_TIER = -1;
+	static constexpr std::size_t NO_LIGHT = std::numeric_limits<std::size_t>::max();
+
+	struct LightShadow
+	{
+		glm::vec3 position = glm::vec3(0.0f);
+		float radius = 0.0f;
+		float coverage = 0.0f;
+		unsigned int desiredTier = 0;
+		int assignedTier = NO_TIER;
+		int tier = NO_TIER; // the tile it holds, slot is only meaningful with a tier
+		unsigned int slot = 0;
+		bool current = false; // the map matches the light and the casters
+		bool drawn = false; // the tile holds a map of this light at all
+		glm::vec3 drawnPosition = glm::vec3(0.0f);
+		float drawnRadius = 0.0f;
+		unsigned int framesWaiting = 0;
+	};
+	std::vector<LightShadow> shadows; // parallel to the LightManager's point lights
+	std::vector<std::size_t> slotOwners[TIER_COUNT]; // light index per slot, NO_LIGHT when free
+	std::vector<std::size_t> order, scheduled;
+	std::vector<glm::vec4> data;
+	bool dataDirty = true;
+	bool wasEnabled = false;
+	Stats stats_;
+	std::size_t capacity = 0;
+	unsigned int atlas, FBO, dataBuffer, dataTexture;
+	// timer queries used round robin, so a result is read when the GPU has it instead of waited for
+	static constexpr unsigned int QUERIES = 3;
+	unsigned int queries[QUERIES];
+	bool queryPending[QUERIES] = {};
+	unsigned int nextQuery = 0;
+
+	// pick up the timings the GPU has finished, oldest first so the newest one ends up in the stats
+	void collectTimings()
+	{
+		for (unsigned int k = 0; k < QUERIES; k++)
+		{
+			const unsigned int i = (nextQuery + k) % QUERIES;
+			if (!queryPending[i])
+				continue;
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+			stats_.lastRenderTime = elapsed * 1e-6;
+			queryPending[i] = false;
+		}
+	}
+
+	static glm::ivec2 faceOrigin(int tier, unsigned int slot, unsigned int face)
+	{
+		const unsigned int perRow = CELL_SIZE / TIERS[tier].faceSize;
+		const unsigned int tile = slot * 6 + face;
+		const unsigned int cell = TIERS[tier].firstCell + tile / (perRow * perRow);
+		const unsigned int inCell = tile % (perRow * perRow);
+		return glm::ivec2((int)((cell % CELLS_PER_ROW) * CELL_SIZE + (inCell % perRow) * TIERS[tier].faceSize),
+			(int)((cell / CELLS_PER_ROW) * CELL_SIZE + (inCell / perRow) * TIERS[tier].faceSize));
+	}
+	void releaseSlot(LightShadow& shadow)
+	{
+		if (shadow.tier == NO_TIER)
+			return;
+		slotOwners[shadow.tier][shadow.slot] = NO_LIGHT;
+		shadow.tier = NO_TIER;
+		shadow.current = shadow.drawn = false;
+		dataDirty = true;
+	}
+	void uploadData()
+	{
+		data.resize(shadows.size() * 2);
+		for (std::size_t i = 0; i < shadows.size(); i++)
+		{
+			const LightShadow& shadow = shadows[i];
+			const bool visible = wasEnabled && shadow.drawn;
+			data[i * 2] = glm::vec4(shadow.drawnPosition, shadow.drawnRadius);
+			data[i * 2 + 1] = glm::vec4(visible ? (float)shadow.tier : -1.0f, (float)shadow.slot, 0.0f, 0.0f);
+		}
+		if (shadows.size() > capacity)
+			reserve(std::max(shadows.size(), capacity * 2));
+		glState.bindBuffer(GL_TEXTURE_BUFFER, dataBuffer);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, data.size() * sizeof(glm::vec4), data.data());
+		glState.bindBuffer(GL_TEXTURE_BUFFER, 0);
+		dataDirty = false;
+	}
+	void reserve(std::size_t lights)
+	{
+		capacity = lights;
+		glState.bindBuffer(GL_TEXTURE_BUFFER, dataBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, capacity * 2 * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+		glState.bindBuffer(GL_TEXTURE_BUFFER, 0);
+		// the texture keeps pointing at the buffer object, re-attach so it sees the new storage
+		glState.activeTexture(GL_TEXTURE0 + POINT_SHADOW_DATA_UNIT);
+		glState.bindTexture(GL_TEXTURE_BUFFER, dataTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, dataBuffer);
+		glState.activeTexture(GL_TEXTURE0);
+	}
+};
+#endif
@@ -0,0 +1,249 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "gl_state_cache.h"
+#include "shaders.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+// passes run in this order, execute() takes one at a time so other work can go in between
+enum RenderPass : unsigned int
+{
+	RENDER_PASS_OPAQUE = 0, // the lit cubes, forward or into the G-buffer
+	RENDER_PASS_LAMPS = 1,  // the light bulbs, after the deferred lighting
+};
+
+// textures a draw needs on units 0 (diffuse) and 1 (specular); register with RenderQueue::material()
+struct RenderMaterial
+{
+	GLuint diffuse = 0;
+	GLuint specular = 0;
+};
+
+// one draw: glDrawArrays(mode, first, count) or its instanced form, plus the per-draw transforms for
+// programs that read them as uniforms; model and normalMatrix are not copied and must outlive execute()
+struct DrawItem
+{
+	GLenum mode = GL_TRIANGLES;
+	GLint first = 0;
+	GLsizei count = 0;
+	GLsizei instances = 1;
+	const glm::mat4* model = nullptr;        // "model" uniform, left alone when null
+	const glm::mat3* normalMatrix = nullptr; // "normalMatrix" uniform, left alone when null
+};
+
+// The frame's draws, submitted in any order and executed sorted by a 64-bit key, most significant first:
+//
+//	63..60 pass | 59..52 program | 51..44 material | 43..36 VAO | 35..12 depth | 11..0 unused
+//
+// so every pass runs in one go, draws sharing a program, then a material, then a VAO follow each other
+// and each run draws front to back. Programs, materials and VAOs get small ids in the order they are
+// first registered in a frame. The keys are sorted with an LSD radix sort over their bytes, which is
+// stable, so draws with equal keys keep their submission order, and it skips every byte the keys
+// agree on, usually more than half of them.
+class RenderQueue
+{
+public:
+	static constexpr unsigned int DEPTH_BITS = 24;
+	static constexpr unsigned int MAX_IDS = 255; // program, material and VAO ids are one byte each
+
+	// state changes and draws of one frame
+	struct StateStats
+	{
+		unsigned int programBinds = 0;
+		unsigned int textureBinds = 0;
+		unsigned int vaoBinds = 0;
+		unsigned int draws = 0;
+	};
+
+	// start a frame: drop the draws and ids of the last one
+	// ------------------------------------------------------------------------
+	void clear()
+	{
+		keys.clear();
+		items.clear();
+		programs.clear();
+		materials.clear();
+		vaos.clear();
+		executed = StateStats();
+		submitted = StateStats();
+		materialId = NONE;
+	}
+	// ids for the key; material id 0 is "no textures", those draws leave units 0 and 1 as they are
+	// ------------------------------------------------------------------------
+	std::uint32_t program(const Shader& shader)
+	{
+		for (std::size_t i = 0; i < programs.size(); i++)
+			if (programs[i].shader == &shader)
+				return (std::uint32_t)i;
+		programs.push_back({ &shader, shader.uniform(std::string("model")), shader.uniform(std::string("normalMatrix")) });
+		return idOf(programs.size() - 1);
+	}
+	std::uint32_t material(const RenderMaterial& textures)
+	{
+		for (std::size_t i = 0; i < materials.size(); i++)
+			if (materials[i].diffuse == textures.diffuse && materials[i].specular == textures.specular)
+				return (std::uint32_t)i + 1;
+		materials.push_back(textures);
+		return idOf(materials.size());
+	}
+	std::uint32_t vao(GLuint name)
+	{
+		for (std::size_t i = 0; i < vaos.size(); i++)
+			if (vaos[i] == name)
+				return (std::uint32_t)i;
+		vaos.push_back(name);
+		return idOf(vaos.size() - 1);
+	}
+
+	// depth is the draw's distance from the camera over the far plane, clamped to [0, 1]; pass the
+	// same value for every draw to keep them in submission order
+	// ------------------------------------------------------------------------
+	void submit(RenderPass pass, std::uint32_t program, std::uint32_t material, std::uint32_t vao, float depth, const DrawItem& item)
+	{
+		const std::uint64_t depthBits = (std::uint64_t)(std::clamp(depth, 0.0f, 1.0f) * ((1u << DEPTH_BITS) - 1));
+		keys.push_back({ (std::uint64_t)pass << 60 | (std::uint64_t)program << 52 | (std::uint64_t)material << 44
+			| (std::uint64_t)vao << 36 | depthBits << 12, (std::uint32_t)items.size() });
+		items.push_back(item);
+	}
+
+	// count what submission order would have cost, then radix sort the keys; call once after the last submit()
+	// ------------------------------------------------------------------------
+	void sort()
+	{
+		std::uint32_t lastPass = NONE, lastProgram = NONE, lastMaterial = NONE, lastVao = NONE;
+		for (const Entry& entry : keys)
+			countChanges(entry.key, lastPass, lastProgram, lastMaterial, lastVao, submitted);
+		scratch.resize(keys.size());
+		for (unsigned int shift = 0; shift < 64; shift += 8)
+		{
+			std::size_t offsets[256] = {};
+			for (const Entry& entry : keys)
+				offsets[(entry.key >> shift) & 0xFF]++;
+			// a byte every key shares would leave the order as it is
+			if (keys.empty() || offsets[(keys[0].key >> shift) & 0xFF] == keys.size())
+				continue;
+			std::size_t sum = 0;
+			for (std::size_t& offset : offsets)
+			{
+				const std::size_t count = offset;
+				offset = sum;
+				sum += count;
+			}
+			for (const Entry& entry : keys)
+				scratch[offsets[(entry.key >> shift) & 0xFF]++] = entry;
+			keys.swap(scratch);
+		}
+	}
+	// issue one pass's draws in key order, switching program, textures and VAO only where the key changes
+	// ------------------------------------------------------------------------
+	void execute(RenderPass pass)
+	{
+		auto first = std::lower_bound(keys.begin(), keys.end(), (std::uint64_t)pass << 60,
+			[](const Entry& entry, std::uint64_t key) { return entry.key < key; });
+		// whatever ran since the last pass may have changed program and VAO, the textures on units 0 and 1 stay
+		std::uint32_t programId = NONE, vaoId = NONE, passId = NONE;
+		for (auto it = first; it != keys.end() && (it->key >> 60) == pass; ++it)
+		{
+			const std::uint32_t boundProgram = programId, boundMaterial = materialId, boundVao = vaoId;
+			countChanges(it->key, passId, programId, materialId, vaoId, executed);
+			const ProgramEntry& bound = programs[programId];
+			if (programId != boundProgram)
+				bound.shader->use();
+			if (materialId != boundMaterial)
+			{
+				const RenderMaterial& textures = materials[materialId - 1];
+				glState.activeTexture(GL_TEXTURE0);
+				glState.bindTexture(GL_TEXTURE_2D, textures.diffuse);
+				glState.activeTexture(GL_TEXTURE1);
+				glState.bindTexture(GL_TEXTURE_2D, textures.specular);
+				glState.activeTexture(GL_TEXTURE0);
+			}
+			if (vaoId != boundVao)
+				glState.bindVertexArray(vaos[vaoId]);
+			const DrawItem& item = items[it->item];
+			if (item.model != nullptr)
+				bound.shader->setMat4(bound.model, *item.model);
+			if (item.normalMatrix != nullptr)
+				bound.shader->setMat3(bound.normalMatrix, *item.normalMatrix);
+			if (item.instances == 1)
+				glDrawArrays(item.mode, item.first, item.count);
+			else
+				glDrawArraysInstanced(item.mode, item.first, item.count, item.instances);
+		}
+	}
+
+	// what the executed passes cost, and what the same draws would have cost in submission order
+	const StateStats& executedStats() const { return executed; }
+	const StateStats& submissionOrderStats() const { return submitted; }
+	std::size_t size() const { return items.size(); }
+
+private:
+	static constexpr std::uint32_t NONE = ~0u;
+
+	struct Entry
+	{
+		std::uint64_t key;
+		std::uint32_t item;
+	};
+	struct ProgramEntry
+	{
+		const Shader* shader;
+		UniformHandle model;
+		UniformHandle normalMatrix;
+	};
+	std::vector<Entry> keys, scratch;
+	std::vector<DrawItem> items;
+	std::vector<ProgramEntry> programs;
+	std::vector<RenderMaterial> materials;
+	std::vector<GLuint> vaos;
+	StateStats executed, submitted;
+	// the material execute() left bound, kept from one pass to the next
+	std::uint32_t materialId = NONE;
+
+	static std::uint32_t idOf(std::size_t index)
+	{
+		if (index > MAX_IDS)
+			std::cout << "ERROR::RENDER_QUEUE::TOO_MANY_IDS" << std::endl;
+		return (std::uint32_t)std::min<std::size_t>(index, MAX_IDS);
+	}
+	// the binds execute() issues for the draw keyed key, given what the draws before it left bound;
+	// a new pass starts with program and VAO unknown
+	static void countChanges(std::uint64_t key, std::uint32_t& boundPass, std::uint32_t& boundProgram,
+		std::uint32_t& boundMaterial, std::uint32_t& boundVao, StateStats& stats)
+	{
+		const std::uint32_t keyPass = (std::uint32_t)(key >> 60);
+		const std::uint32_t keyProgram = (std::uint32_t)(key >> 52) & 0xFF;
+		const std::uint32_t keyMaterial = (std::uint32_t)(key >> 44) & 0xFF;
+		const std::uint32_t keyVao = (std::uint32_t)(key >> 36) & 0xFF;
+		if (keyPass != boundPass)
+		{
+			boundPass = keyPass;
+			boundProgram = boundVao = NONE;
+		}
+		if (keyProgram != boundProgram)
+		{
+			boundProgram = keyProgram;
+			stats.programBinds++;
+		}
+		// material 0 has no textures and leaves the last ones bound
+		if (keyMaterial != boundMaterial && keyMaterial != 0)
+		{
+			boundMaterial = keyMaterial;
+			stats.textureBinds += 2;
+		}
+		if (keyVao != boundVao)
+		{
+			boundVao = keyVao;
+			stats.vaoBinds++;
+		}
+		stats.draws++;
+	}
+};
+#endif
@@ -0,0 +1,332 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_access.hpp>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SCENE_BVH_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define SCENE_BVH_SSE
+#endif
+
+struct Aabb
+{
+	glm::vec3 lower;
+	glm::vec3 upper;
+};
+
+// the box around a transformed box: the centre moves with the matrix, the extent by its absolute value
+// ------------------------------------------------------------------------
+inline Aabb transformAabb(const Aabb& box, const glm::mat4& transform)
+{
+	const glm::vec3 centre = glm::vec3(transform * glm::vec4((box.lower + box.upper) * 0.5f, 1.0f));
+	const glm::mat3 absolute(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+	const glm::vec3 extent = absolute * ((box.upper - box.lower) * 0.5f);
+	return { centre - extent, centre + extent };
+}
+
+// The six planes of a view frustum, pointing inwards: a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+// for all of them. Taken from the rows of projection * view (Gribb and Hartmann).
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+inline Frustum frustumFromMatrix(const glm::mat4& viewProjection)
+{
+	const glm::vec4 w = glm::row(viewProjection, 3);
+	Frustum frustum;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		frustum.planes[axis * 2] = w + glm::row(viewProjection, axis);
+		frustum.planes[axis * 2 + 1] = w - glm::row(viewProjection, axis);
+	}
+	for (glm::vec4& plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+	return frustum;
+}
+
+// Bounding volume hierarchy over the scene's objects for frustum culling on the CPU. Every node has
+// WIDTH = 8 children, each an inner node or directly an object, and keeps their boxes as structure
+// of arrays so one node is tested against a plane in one go: an AVX register when the compiler
+// targets it, two SSE halves otherwise. A child entirely inside the frustum takes its whole subtree
+// along without further tests.
+// build() splits the objects top down, three median cuts along the longest axis per node. Objects
+// that move keep their place in the tree; refit() widens or shrinks the boxes on the way to the root.
+class SceneBvh
+{
+public:
+	static constexpr unsigned int WIDTH = 8;
+
+	struct CullStats
+	{
+		std::size_t objects = 0;
+		std::size_t visible = 0;
+		std::size_t nodesTested = 0;
+	};
+
+	// (re)build over the objects' world space boxes, object i is reported as index i
+	// ------------------------------------------------------------------------
+	void build(const std::vector<Aabb>& objects)
+	{
+		nodes.clear();
+		objectLanes.assign(objects.size(), EMPTY);
+		if (objects.empty())
+			return;
+		std::vector<std::uint32_t> order(objects.size());
+		std::vector<glm::vec3> centres(objects.size());
+		for (std::size_t i = 0; i < objects.size(); i++)
+		{
+			order[i] = (std::uint32_t)i;
+			centres[i] = (objects[i].lower + objects[i].upper) * 0.5f;
+		}
+		nodes.reserve(objects.size() / (WIDTH - 1) + 1);
+		buildNode(objects, centres, order.data(), order.size(), EMPTY);
+	}
+	// one object moved: update its box and every box above it
+	// ------------------------------------------------------------------------
+	void refit(std::uint32_t object, const Aabb& box)
+	{
+		std::uint32_t lane = objectLanes[object];
+		setLane(lane, box);
+		for (std::uint32_t node = lane / WIDTH; nodes[node].parent != EMPTY; node = lane / WIDTH)
+		{
+			lane = nodes[node].parent;
+			const Aabb bounds = nodeBounds(nodes[node]);
+			const Node& parent = nodes[lane / WIDTH];
+			const unsigned int i = lane % WIDTH;
+			// the ancestors above an unchanged box stay as they are
+			if (bounds.lower == glm::vec3(parent.lowerX[i], parent.lowerY[i], parent.lowerZ[i])
+				&& bounds.upper == glm::vec3(parent.upperX[i], parent.upperY[i], parent.upperZ[i]))
+				break;
+			setLane(lane, bounds);
+		}
+	}
+	// the indices of the objects whose box touches the frustum, in tree order
+	// ------------------------------------------------------------------------
+	CullStats cull(const Frustum& frustum, std::vector<std::uint32_t>& visible) const
+	{
+		visible.clear();
+		CullStats stats;
+		stats.objects = objectLanes.size();
+		if (nodes.empty())
+			return stats;
+		std::uint32_t stack[256]; // WIDTH - 1 siblings wait per level, the tree is log8(objects) deep
+		unsigned int depth = 0;
+		stack[depth++] = 0;
+		while (depth > 0)
+		{
+			const Node& node = nodes[stack[--depth]];
+			stats.nodesTested++;
+			unsigned int inside;
+			unsigned int touching = testNode(node, frustum, inside);
+			for (; touching != 0; touching &= touching - 1)
+			{
+				const unsigned int i = lowestBit(touching);
+				const std::uint32_t child = node.child[i];
+				if (child & OBJECT)
+					visible.push_back(child & ~OBJECT);
+				else if (inside & (1u << i))
+					appendSubtree(child, visible);
+				else
+					stack[depth++] = child;
+			}
+		}
+		stats.visible = visible.size();
+		return stats;
+	}
+	std::size_t nodeCount() const { return nodes.size(); }
+
+private:
+	static constexpr std::uint32_t EMPTY = std::numeric_limits<std::uint32_t>::max();
+	static constexpr std::uint32_t OBJECT = 0x80000000u; // child is an object index, not a node
+
+	struct Node
+	{
+		float lowerX[WIDTH], lowerY[WIDTH], lowerZ[WIDTH];
+		float upperX[WIDTH], upperY[WIDTH], upperZ[WIDTH];
+		std::uint32_t child[WIDTH];
+		std::uint32_t parent; // node * WIDTH + lane of this node in its parent, EMPTY for the root
+		unsigned int used; // bit mask of the lanes that hold a child
+	};
+	std::vector<Node> nodes;
+	std::vector<std::uint32_t> objectLanes; // node * WIDTH + lane per object
+
+	static unsigned int lowestBit(unsigned int mask)
+	{
+		unsigned int i = 0;
+		while (!(mask & (1u << i)))
+			i++;
+		return i;
+	}
+	void setLane(std::uint32_t lane, const Aabb& box)
+	{
+		Node& node = nodes[lane / WIDTH];
+		const unsigned int i = lane % WIDTH;
+		node.lowerX[i] = box.lower.x;
+		node.lowerY[i] = box.lower.y;
+		node.lowerZ[i] = box.lower.z;
+		node.upperX[i] = box.upper.x;
+		node.upperY[i] = box.upper.y;
+		node.upperZ[i] = box.upper.z;
+	}
+	static Aabb nodeBounds(const Node& node)
+	{
+		Aabb bounds{ glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+		for (unsigned int i = 0; i < WIDTH; i++)
+		{
+			if (!(node.used & (1u << i)))
+				continue;
+			bounds.lower = glm::min(bounds.lower, glm::vec3(node.lowerX[i], node.lowerY[i], node.lowerZ[i]));
+			bounds.upper = glm::max(bounds.upper, glm::vec3(node.upperX[i], node.upperY[i], node.upperZ[i]));
+		}
+		return bounds;
+	}
+	// a node for objects[order[0..count)], returns its index
+	std::uint32_t buildNode(const std::vector<Aabb>& objects, const std::vector<glm::vec3>& centres,
+		std::uint32_t* order, std::size_t count, std::uint32_t parent)
+	{
+		const std::uint32_t index = (std::uint32_t)nodes.size();
+		nodes.emplace_back();
+		nodes[index].parent = parent;
+		nodes[index].used = 0;
+		// cut the range in halves until there are WIDTH groups, or fewer when it runs out of objects
+		std::size_t bounds[WIDTH + 1] = { 0, count };
+		unsigned int groups = 1;
+		while (groups < WIDTH && count > groups)
+		{
+			std::size_t split[WIDTH + 1];
+			unsigned int splitGroups = 0;
+			for (unsigned int g = 0; g < groups; g++)
+			{
+				std::uint32_t* begin = order + bounds[g];
+				std::uint32_t* end = order + bounds[g + 1];
+				split[splitGroups++] = bounds[g];
+				if (end - begin < 2)
+					continue;
+				glm::vec3 lower(std::numeric_limits<float>::max()), upper(-std::numeric_limits<float>::max());
+				for (std::uint32_t* i = begin; i != end; i++)
+				{
+					lower = glm::min(lower, centres[*i]);
+					upper = glm::max(upper, centres[*i]);
+				}
+				const glm::vec3 extent = upper - lower;
+				const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+				std::uint32_t* middle = begin + (end - begin) / 2;
+				std::nth_element(begin, middle, end, [&](std::uint32_t lhs, std::uint32_t rhs) { return centres[lhs][axis] < centres[rhs][axis]; });
+				split[splitGroups++] = (std::size_t)(middle - order);
+			}
+			split[splitGroups] = count;
+			std::copy(split, split + splitGroups + 1, bounds);
+			groups = splitGroups;
+		}
+		for (unsigned int g = 0; g < groups; g++)
+		{
+			const std::uint32_t lane = index * WIDTH + g;
+			const std::size_t size = bounds[g + 1] - bounds[g];
+			std::uint32_t child;
+			Aabb box;
+			if (size == 1)
+			{
+				child = order[bounds[g]] | OBJECT;
+				box = objects[order[bounds[g]]];
+				objectLanes[order[bounds[g]]] = lane;
+			}
+			else
+			{
+				child = buildNode(objects, centres, order + bounds[g], size, lane);
+				box = nodeBounds(nodes[child]);
+			}
+			nodes[index].child[g] = child;
+			nodes[index].used |= 1u << g;
+			setLane(lane, box);
+		}
+		for (unsigned int g = groups; g < WIDTH; g++)
+		{
+			nodes[index].child[g] = EMPTY;
+			setLane(index * WIDTH + g, { glm::vec3(0.0f), glm::vec3(0.0f) });
+		}
+		return index;
+	}
+	void appendSubtree(std::uint32_t node, std::vector<std::uint32_t>& visible) const
+	{
+		for (unsigned int used = nodes[node].used; used != 0; used &= used - 1)
+		{
+			const std::uint32_t child = nodes[node].child[lowestBit(used)];
+			if (child & OBJECT)
+				visible.push_back(child & ~OBJECT);
+			else
+				appendSubtree(child, visible);
+		}
+	}
+	// bit mask of the lanes whose box touches the frustum; inside gets the lanes entirely within it.
+	// Per plane the box corner furthest along the normal decides whether it is outside, the nearest
+	// one whether it is inside: per axis that is max / min of normal * lower and normal * upper.
+	static unsigned int testNode(const Node& node, const Frustum& frustum, unsigned int& inside)
+	{
+		unsigned int outside = 0, crossing = 0;
+#if defined(SCENE_BVH_AVX)
+		const __m256 lx = _mm256_loadu_ps(node.lowerX), ly = _mm256_loadu_ps(node.lowerY), lz = _mm256_loadu_ps(node.lowerZ);
+		const __m256 ux = _mm256_loadu_ps(node.upperX), uy = _mm256_loadu_ps(node.upperY), uz = _mm256_loadu_ps(node.upperZ);
+		const __m256 zero = _mm256_setzero_ps();
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			const __m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z);
+			const __m256 xl = _mm256_mul_ps(nx, lx), xu = _mm256_mul_ps(nx, ux);
+			const __m256 yl = _mm256_mul_ps(ny, ly), yu = _mm256_mul_ps(ny, uy);
+			const __m256 zl = _mm256_mul_ps(nz, lz), zu = _mm256_mul_ps(nz, uz);
+			const __m256 w = _mm256_set1_ps(plane.w);
+			const __m256 furthest = _mm256_add_ps(_mm256_add_ps(_mm256_max_ps(xl, xu), _mm256_max_ps(yl, yu)), _mm256_add_ps(_mm256_max_ps(zl, zu), w));
+			const __m256 nearest = _mm256_add_ps(_mm256_add_ps(_mm256_min_ps(xl, xu), _mm256_min_ps(yl, yu)), _mm256_add_ps(_mm256_min_ps(zl, zu), w));
+			outside |= (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(furthest, zero, _CMP_LT_OQ));
+			crossing |= (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(nearest, zero, _CMP_LT_OQ));
+		}
+#elif defined(SCENE_BVH_SSE)
+		const __m128 zero = _mm_setzero_ps();
+		for (unsigned int half = 0; half < WIDTH; half += 4)
+		{
+			const __m128 lx = _mm_loadu_ps(node.lowerX + half), ly = _mm_loadu_ps(node.lowerY + half), lz = _mm_loadu_ps(node.lowerZ + half);
+			const __m128 ux = _mm_loadu_ps(node.upperX + half), uy = _mm_loadu_ps(node.upperY + half), uz = _mm_loadu_ps(node.upperZ + half);
+			for (const glm::vec4& plane : frustum.planes)
+			{
+				const __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+				const __m128 xl = _mm_mul_ps(nx, lx), xu = _mm_mul_ps(nx, ux);
+				const __m128 yl = _mm_mul_ps(ny, ly), yu = _mm_mul_ps(ny, uy);
+				const __m128 zl = _mm_mul_ps(nz, lz), zu = _mm_mul_ps(nz, uz);
+				const __m128 w = _mm_set1_ps(plane.w);
+				const __m128 furthest = _mm_add_ps(_mm_add_ps(_mm_max_ps(xl, xu), _mm_max_ps(yl, yu)), _mm_add_ps(_mm_max_ps(zl, zu), w));
+				const __m128 nearest = _mm_add_ps(_mm_add_ps(_mm_min_ps(xl, xu), _mm_min_ps(yl, yu)), _mm_add_ps(_mm_min_ps(zl, zu), w));
+				outside |= (unsigned int)_mm_movemask_ps(_mm_cmplt_ps(furthest, zero)) << half;
+				crossing |= (unsigned int)_mm_movemask_ps(_mm_cmplt_ps(nearest, zero)) << half;
+			}
+		}
+#else
+		for (unsigned int i = 0; i < WIDTH; i++)
+		{
+			for (const glm::vec4& plane : frustum.planes)
+			{
+				const glm::vec3 lower = glm::vec3(plane) * glm::vec3(node.lowerX[i], node.lowerY[i], node.lowerZ[i]);
+				const glm::vec3 upper = glm::vec3(plane) * glm::vec3(node.upperX[i], node.upperY[i], node.upperZ[i]);
+				const glm::vec3 furthest = glm::max(lower, upper), nearest = glm::min(lower, upper);
+				if (furthest.x + furthest.y + furthest.z + plane.w < 0.0f)
+					outside |= 1u << i;
+				if (nearest.x + nearest.y + nearest.z + plane.w < 0.0f)
+					crossing |= 1u << i;
+			}
+		}
+#endif
+		const unsigned int touching = node.used & ~outside;
+		inside = touching & ~crossing;
+		return touching;
+	}
+};
+#endif
@@ -0,0 +1,55 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include "shaders.h"
+
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <unordered_map>
+
+// One vertex/fragment pair compiled into specialised programs. A feature bitmask picks the
+// variant and a caller supplied function turns it into #defines, so dead branches and loops are
+// removed by the GLSL compiler instead of being skipped at run time. Variants are compiled on
+// first use and kept for the lifetime of the table (which also feeds ProgramBinaryCache, the
+// defines are part of the source it hashes).
+class ShaderVariants
+{
+public:
+	using DefinesFunction = std::string (*)(std::uint32_t features);
+
+	ShaderVariants(const char* vertexPath, const char* fragmentPath, DefinesFunction definesFor)
+		: vertexPath(vertexPath), fragmentPath(fragmentPath), definesFor(definesFor)
+	{
+	}
+	// the program for this feature set, compiled now if it is the first request for it;
+	// the reference stays valid while the table lives
+	// ------------------------------------------------------------------------
+	const Shader& get(std::uint32_t features)
+	{
+		auto it = variants.find(features);
+		if (it == variants.end())
+			it = variants.emplace(features, Shader(vertexPath.c_str(), fragmentPath.c_str(), definesFor(features))).first;
+		return it->second;
+	}
+	// hand over a program built elsewhere with defines(features), e.g. prewarmed in a ShaderBatch
+	// ------------------------------------------------------------------------
+	void adopt(std::uint32_t features, Shader shader)
+	{
+		variants.insert_or_assign(features, std::move(shader));
+	}
+	std::string defines(std::uint32_t features) const
+	{
+		return definesFor(features);
+	}
+	const std::string& vertex() const { return vertexPath; }
+	const std::string& fragment() const { return fragmentPath; }
+	std::size_t size() const { return variants.size(); }
+
+private:
+	std::string vertexPath;
+	std::string fragmentPath;
+	DefinesFunction definesFor;
+	std::unordered_map<std::uint32_t, Shader> variants;
+};
+#endif
@@ -3,51 +3,108 @@
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include "gl_state_cache.h"
+#include "program_binary_cache.h"
 
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// FNV-1a, usable both at compile time (uniform name literals) and at run time (std::string names)
+constexpr std::uint64_t hashUniformName(const char* text, std::size_t length)
+{
+	std::uint64_t hash = 14695981039346656037ull;
+	for (std::size_t i = 0; i < length; i++)
+	{
+		hash ^= static_cast<unsigned char>(text[i]);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// a uniform name hashed at compile time, spelled "material.shininess"_u
+struct UniformName
+{
+	std::uint64_t hash;
+	const char* text; // only read for diagnostics
+};
+
+consteval UniformName operator""_u(const char* text, std::size_t length)
+{
+	return UniformName{ hashUniformName(text, length), text };
+}
+
+// fixed binding points for uniform blocks shared by every program, Shader binds them after link
+enum UniformBlockBinding : GLuint
+{
+	FRAME_CONSTANTS_BINDING = 0,
+	LIGHTS_BINDING = 1,
+	SHADOW_CASCADES_BINDING = 2,
+};
+struct UniformBlockSlot
+{
+	const char* blockName;
+	UniformBlockBinding binding;
+};
+inline constexpr UniformBlockSlot SHARED_UNIFORM_BLOCKS[] = {
+	{ "FrameConstants", FRAME_CONSTANTS_BINDING },
+	{ "Lights", LIGHTS_BINDING },
+	{ "ShadowCascades", SHADOW_CASCADES_BINDING },
+};
+
+// opaque handle to an active uniform, resolve it once with Shader::uniform() and reuse it every frame
+class UniformHandle
+{
+public:
+	UniformHandle() = default;
+	bool valid() const { return location != -1; }
+
+private:
+	friend class Shader;
+	explicit UniformHandle(GLint location) : location(location) {}
+	GLint location = -1;
+};
+
+struct UniformStats
+{
+	unsigned int hits = 0;   // skipped, the program already held that value
+	unsigned int misses = 0; // forwarded to glUniform*
+};
+
 class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// true when the program was restored from ProgramBinaryCache instead of compiled
+	bool loadedFromCache = false;
+	// constructor generates the shader on the fly; defines ("#define NAME value" lines) are
+	// spliced into both stages right after #version, see ShaderVariants
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath)
+	Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = std::string())
 	{
 		// 1. retrieve the vertex/fragment source code from filePath
-		std::string vertexCode;
-		std::string fragmentCode;
-		std::ifstream vShaderFile;
-		std::ifstream fShaderFile;
-		// ensure ifstream objects can throw exceptions:
-		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		try
-		{
-			// open files
-			vShaderFile.open(vertexPath);
-			fShaderFile.open(fragmentPath);
-			std::stringstream vShaderStream, fShaderStream;
-			// read file's buffer contents into streams
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
-			// close file handlers
-			vShaderFile.close();
-			fShaderFile.close();
-			// convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
-		}
-		catch (std::ifstream::failure& e)
+		std::string vertexCode = injectDefines(readSource(vertexPath), defines);
+		std::string fragmentCode = injectDefines(readSource(fragmentPath), defines);
+		// 2. reuse the linked binary from a previous run when the driver allows it
+		ID = glCreateProgram();
+		const bool useCache = ProgramBinaryCache::enabled();
+		const std::uint64_t cacheKey = useCache ? ProgramBinaryCache::key(vertexCode, fragmentCode) : 0;
+		if (useCache && ProgramBinaryCache::load(ID, cacheKey))
 		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+			loadedFromCache = true;
+			buildUniformTable();
+			bindSharedUniformBlocks();
+			return;
 		}
 		const char* vShaderCode = vertexCode.c_str();
 		const char* fShaderCode = fragmentCode.c_str();
-		// 2. compile shaders
+		// 3. compile shaders
 		unsigned int vertex, fragment;
 		// vertex shader
 		vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -60,85 +117,355 @@ public:
 		glCompileShader(fragment);
 		checkCompileErrors(fragment, "FRAGMENT");
 		// shader Program
-		ID = glCreateProgram();
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
+		if (useCache)
+			glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
+		if (checkCompileErrors(ID, "PROGRAM") && useCache)
+			ProgramBinaryCache::store(ID, cacheKey);
 		// delete the shaders as they're linked into our program now and no longer necessary
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
-
+		// 4. enumerate the active uniforms once so the set* calls never go back to the driver
+		buildUniformTable();
+		bindSharedUniformBlocks();
+	}
+	// read a whole shader source file, reports and returns an empty string on failure
+	// ------------------------------------------------------------------------
+	static std::string readSource(const char* path)
+	{
+		std::ifstream shaderFile;
+		// ensure ifstream objects can throw exceptions:
+		shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			shaderFile.open(path);
+			std::stringstream shaderStream;
+			shaderStream << shaderFile.rdbuf();
+			shaderFile.close();
+			return shaderStream.str();
+		}
+		catch (std::ifstream::failure& e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+		}
+		return std::string();
+	}
+	// insert defines after the #version line, which has to stay the first statement
+	// ------------------------------------------------------------------------
+	static std::string injectDefines(const std::string& source, const std::string& defines)
+	{
+		if (defines.empty())
+			return source;
+		std::size_t insertAt = 0;
+		const std::size_t version = source.find("#version");
+		if (version != std::string::npos)
+		{
+			const std::size_t lineEnd = source.find('\n', version);
+			insertAt = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+		}
+		std::string result = source.substr(0, insertAt);
+		if (!result.empty() && result.back() != '\n')
+			result += '\n';
+		result += defines;
+		if (result.back() != '\n')
+			result += '\n';
+		result += source.substr(insertAt);
+		return result;
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use() const
 	{
-		glUseProgram(ID);
+		glState.useProgram(ID);
 	}
-	// utility uniform functions
+	// look up an active uniform; unknown names give an invalid handle which set* silently ignores
 	// ------------------------------------------------------------------------
-	void setBool(const std::string& name, bool value) const
+	UniformHandle uniform(const std::string& name) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		const UniformEntry* entry = findUniform(hashUniformName(name.data(), name.size()));
+		if (entry == nullptr || entry->name != name)
+			return UniformHandle();
+		return UniformHandle(entry->location);
 	}
+	// compile-time hashed names skip string construction and hashing entirely; debug builds
+	// assert the name exists so typos are caught, release builds drop the check
 	// ------------------------------------------------------------------------
-	void setInt(const std::string& name, int value) const
+	UniformHandle uniform(UniformName name) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		const UniformEntry* entry = findUniform(name.hash);
+#ifndef NDEBUG
+		if (entry == nullptr)
+			std::cout << "ERROR::SHADER::UNKNOWN_UNIFORM: " << name.text << std::endl;
+#endif
+		assert(entry != nullptr && "uniform is not active in this program");
+		return entry != nullptr ? UniformHandle(entry->location) : UniformHandle();
 	}
+	// set* calls that found the value already in the program vs. ones that reached glUniform*;
+	// read and reset once per frame to see how much driver traffic the shadow copy removed
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string& name, float value) const
+	UniformStats uniformStats() const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		return stats;
 	}
+	void resetUniformStats() const
+	{
+		stats = UniformStats();
+	}
+	// utility uniform functions, each takes a UniformHandle, a "name"_u literal or a std::string;
+	// values equal to the last one set on this program skip the driver call
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string& name, const glm::vec2& value) const
+	void setBool(UniformHandle handle, bool value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setInt(handle, (int)value);
 	}
-	void setVec2(const std::string& name, float x, float y) const
+	template <typename Name>
+	void setBool(const Name& name, bool value) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		setBool(uniform(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string& name, const glm::vec3& value) const
+	void setInt(UniformHandle handle, int value) const
+	{
+		if (changed(handle.location, value))
+			glUniform1i(handle.location, value);
+	}
+	template <typename Name>
+	void setInt(const Name& name, int value) const
+	{
+		setInt(uniform(name), value);
+	}
+	// ------------------------------------------------------------------------
+	void setFloat(UniformHandle handle, float value) const
+	{
+		if (changed(handle.location, value))
+			glUniform1f(handle.location, value);
+	}
+	template <typename Name>
+	void setFloat(const Name& name, float value) const
+	{
+		setFloat(uniform(name), value);
+	}
+	// ------------------------------------------------------------------------
+	void setVec2(UniformHandle handle, const glm::vec2& value) const
+	{
+		if (changed(handle.location, value))
+			glUniform2fv(handle.location, 1, &value[0]);
+	}
+	void setVec2(UniformHandle handle, float x, float y) const
+	{
+		setVec2(handle, glm::vec2(x, y));
+	}
+	template <typename Name>
+	void setVec2(const Name& name, const glm::vec2& value) const
+	{
+		setVec2(uniform(name), value);
+	}
+	template <typename Name>
+	void setVec2(const Name& name, float x, float y) const
+	{
+		setVec2(uniform(name), x, y);
+	}
+	// ------------------------------------------------------------------------
+	void setVec3(UniformHandle handle, const glm::vec3& value) const
+	{
+		if (changed(handle.location, value))
+			glUniform3fv(handle.location, 1, &value[0]);
+	}
+	void setVec3(UniformHandle handle, float x, float y, float z) const
+	{
+		setVec3(handle, glm::vec3(x, y, z));
+	}
+	template <typename Name>
+	void setVec3(const Name& name, const glm::vec3& value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec3(uniform(name), value);
 	}
-	void setVec3(const std::string& name, float x, float y, float z) const
+	template <typename Name>
+	void setVec3(const Name& name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		setVec3(uniform(name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string& name, const glm::vec4& value) const
+	void setVec4(UniformHandle handle, const glm::vec4& value) const
+	{
+		if (changed(handle.location, value))
+			glUniform4fv(handle.location, 1, &value[0]);
+	}
+	void setVec4(UniformHandle handle, float x, float y, float z, float w) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec4(handle, glm::vec4(x, y, z, w));
 	}
-	void setVec4(const std::string& name, float x, float y, float z, float w) const
+	template <typename Name>
+	void setVec4(const Name& name, const glm::vec4& value) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		setVec4(uniform(name), value);
+	}
+	template <typename Name>
+	void setVec4(const Name& name, float x, float y, float z, float w) const
+	{
+		setVec4(uniform(name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string& name, const glm::mat2& mat) const
+	void setMat2(UniformHandle handle, const glm::mat2& mat) const
+	{
+		if (changed(handle.location, mat))
+			glUniformMatrix2fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+	}
+	template <typename Name>
+	void setMat2(const Name& name, const glm::mat2& mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat2(uniform(name), mat);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string& name, const glm::mat3& mat) const
+	void setMat3(UniformHandle handle, const glm::mat3& mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (changed(handle.location, mat))
+			glUniformMatrix3fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+	}
+	template <typename Name>
+	void setMat3(const Name& name, const glm::mat3& mat) const
+	{
+		setMat3(uniform(name), mat);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string& name, const glm::mat4& mat) const
+	void setMat4(UniformHandle handle, const glm::mat4& mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (changed(handle.location, mat))
+			glUniformMatrix4fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+	}
+	template <typename Name>
+	void setMat4(const Name& name, const glm::mat4& mat) const
+	{
+		setMat4(uniform(name), mat);
 	}
 
 private:
-	// utility function for checking shader compilation/linking errors.
+	friend class ShaderBatch;
+	// wraps a program that ShaderBatch already linked and checked
+	Shader(unsigned int program, bool fromCache) : ID(program), loadedFromCache(fromCache)
+	{
+		buildUniformTable();
+		bindSharedUniformBlocks();
+	}
+
+	// CPU copy of the last value set at each location, indexed by location. Uniform values live
+	// in the program object, so the copy stays valid across use() switches; it only has to start
+	// empty because a fresh link (or binary load) resets every uniform to zero.
+	struct UniformShadow
+	{
+		bool set = false;
+		unsigned char bytes[sizeof(glm::mat4)];
+	};
+	mutable std::vector<UniformShadow> uniformShadow;
+	mutable UniformStats stats;
+
+	// true when value differs from the shadow copy, which is then updated
+	template <typename T>
+	bool changed(GLint location, const T& value) const
+	{
+		static_assert(sizeof(T) <= sizeof(UniformShadow::bytes), "uniform value too large for the shadow copy");
+		if (location < 0)
+			return false; // inactive uniform, glUniform* would ignore it anyway
+		if ((std::size_t)location >= uniformShadow.size())
+		{
+			stats.misses++;
+			return true;
+		}
+		UniformShadow& shadow = uniformShadow[location];
+		if (shadow.set && std::memcmp(shadow.bytes, &value, sizeof(T)) == 0)
+		{
+			stats.hits++;
+			return false;
+		}
+		std::memcpy(shadow.bytes, &value, sizeof(T));
+		shadow.set = true;
+		stats.misses++;
+		return true;
+	}
+
+	struct UniformEntry
+	{
+		std::uint64_t hash;
+		std::string name;
+		GLint location;
+	};
+	// sorted by hash so compile-time hashed names resolve with a binary search
+	std::vector<UniformEntry> uniformTable;
+
+	const UniformEntry* findUniform(std::uint64_t hash) const
+	{
+		auto it = std::lower_bound(uniformTable.begin(), uniformTable.end(), hash,
+			[](const UniformEntry& entry, std::uint64_t value) { return entry.hash < value; });
+		return (it != uniformTable.end() && it->hash == hash) ? &*it : nullptr;
+	}
+	// query every active uniform after link; each array element gets its own entry ("offsets[2]")
 	// ------------------------------------------------------------------------
-	void checkCompileErrors(GLuint shader, std::string type)
+	void buildUniformTable()
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		uniformTable.clear();
+		std::vector<GLchar> buffer(maxLength > 0 ? maxLength : 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+			std::string name(buffer.data(), length);
+			GLint location = glGetUniformLocation(ID, name.c_str());
+			if (location == -1) // uniform block members have no location
+				continue;
+			addUniform(name, location);
+			// arrays of basic types are reported once as "name[0]"
+			if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			{
+				const std::string base = name.substr(0, name.size() - 3);
+				addUniform(base, location);
+				for (GLint element = 1; element < size; element++)
+				{
+					const std::string elementName = base + "[" + std::to_string(element) + "]";
+					addUniform(elementName, glGetUniformLocation(ID, elementName.c_str()));
+				}
+			}
+		}
+
+		GLint maxLocation = -1;
+		for (const UniformEntry& entry : uniformTable)
+			maxLocation = std::max(maxLocation, entry.location);
+		uniformShadow.assign((std::size_t)(maxLocation + 1), UniformShadow());
+
+		std::sort(uniformTable.begin(), uniformTable.end(),
+			[](const UniformEntry& lhs, const UniformEntry& rhs) { return lhs.hash < rhs.hash; });
+		// two names sharing a hash would make one of them unreachable, so report it loudly
+		for (std::size_t i = 1; i < uniformTable.size(); i++)
+		{
+			if (uniformTable[i].hash == uniformTable[i - 1].hash)
+				std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION: " << uniformTable[i - 1].name << " and " << uniformTable[i].name << std::endl;
+		}
+	}
+	void addUniform(const std::string& name, GLint location)
+	{
+		uniformTable.push_back(UniformEntry{ hashUniformName(name.data(), name.size()), name, location });
+	}
+	// attach every shared block this program declares to its fixed binding point
+	// ------------------------------------------------------------------------
+	void bindSharedUniformBlocks()
+	{
+		for (const UniformBlockSlot& slot : SHARED_UNIFORM_BLOCKS)
+		{
+			const GLuint index = glGetUniformBlockIndex(ID, slot.blockName);
+			if (index != GL_INVALID_INDEX)
+				glUniformBlockBinding(ID, index, slot.binding);
+		}
+	}
+	// utility function for checking shader compilation/linking errors, returns true on success
+	// ------------------------------------------------------------------------
+	static bool checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -160,6 +487,88 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success != 0;
+	}
+};
+
+// Builds several programs without stalling on each one: add() hands every compile and link to the
+// driver straight away and only finish() reads GL_COMPILE_STATUS/GL_LINK_STATUS, which is where
+// the caller waits. With GL_KHR_parallel_shader_compile the driver compiles on its own threads
+// meanwhile, so textures loaded between add() and finish() hide the compile time.
+class ShaderBatch
+{
+public:
+	ShaderBatch()
+	{
+		if (GLAD_GL_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); // let the driver pick the thread count
 	}
+	// queue a program, returns its index into the vector handed out by finish()
+	// ------------------------------------------------------------------------
+	std::size_t add(const char* vertexPath, const char* fragmentPath, const std::string& defines = std::string())
+	{
+		const std::string vertexCode = Shader::injectDefines(Shader::readSource(vertexPath), defines);
+		const std::string fragmentCode = Shader::injectDefines(Shader::readSource(fragmentPath), defines);
+		Pending pending;
+		pending.program = glCreateProgram();
+		pending.useCache = ProgramBinaryCache::enabled();
+		pending.cacheKey = pending.useCache ? ProgramBinaryCache::key(vertexCode, fragmentCode) : 0;
+		if (pending.useCache && ProgramBinaryCache::load(pending.program, pending.cacheKey))
+		{
+			pending.fromCache = true;
+			programs.push_back(pending);
+			return programs.size() - 1;
+		}
+		const char* vShaderCode = vertexCode.c_str();
+		const char* fShaderCode = fragmentCode.c_str();
+		pending.vertex = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(pending.vertex, 1, &vShaderCode, NULL);
+		glCompileShader(pending.vertex);
+		pending.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(pending.fragment, 1, &fShaderCode, NULL);
+		glCompileShader(pending.fragment);
+		// linking does not need the compile status, a failed compile just fails the link
+		glAttachShader(pending.program, pending.vertex);
+		glAttachShader(pending.program, pending.fragment);
+		if (pending.useCache)
+			glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(pending.program);
+		programs.push_back(pending);
+		return programs.size() - 1;
+	}
+	// check and report every compile/link status, then hand out the programs in add() order
+	// ------------------------------------------------------------------------
+	std::vector<Shader> finish()
+	{
+		std::vector<Shader> shaders;
+		shaders.reserve(programs.size());
+		for (const Pending& pending : programs)
+		{
+			if (!pending.fromCache)
+			{
+				Shader::checkCompileErrors(pending.vertex, "VERTEX");
+				Shader::checkCompileErrors(pending.fragment, "FRAGMENT");
+				if (Shader::checkCompileErrors(pending.program, "PROGRAM") && pending.useCache)
+					ProgramBinaryCache::store(pending.program, pending.cacheKey);
+				glDeleteShader(pending.vertex);
+				glDeleteShader(pending.fragment);
+			}
+			shaders.push_back(Shader(pending.program, pending.fromCache));
+		}
+		programs.clear();
+		return shaders;
+	}
+
+private:
+	struct Pending
+	{
+		unsigned int program = 0;
+		unsigned int vertex = 0;
+		unsigned int fragment = 0;
+		bool useCache = false;
+		bool fromCache = false;
+		std::uint64_t cacheKey = 0;
+	};
+	std::vector<Pending> programs;
 };
 #endif
\ No newline at end of file
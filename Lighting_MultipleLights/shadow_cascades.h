@@ -0,0 +1,263 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "gl_state_cache.h"
+#include "block_layout.h"
+#include "shaders.h"
+#include "lights.h"
+
+#include <cmath>
+#include <limits>
+#include <cstddef>
+#include <iostream>
+#include <algorithm>
+
+// texture unit of the cascade array, after the G-buffer's 5-7
+const unsigned int SHADOW_MAP_UNIT = 8;
+
+// C++ mirror of the std140 block the DIR_SHADOWS variants declare:
+//
+//	layout (std140) uniform ShadowCascades
+//	{
+//		mat4 cascadeViewProjection[SHADOW_CASCADE_COUNT];
+//		vec4 cascadeSplits;
+//		vec4 cascadeNormalOffsets;
+//	};
+struct ShadowCascadesBlock
+{
+	alignas(std140Alignment<glm::mat4>) glm::mat4 viewProjection[SHADOW_CASCADE_COUNT];
+	alignas(std140Alignment<glm::vec4>) glm::vec4 splits; // view depth at which each cascade ends, 0 when shadows are off
+	alignas(std140Alignment<glm::vec4>) glm::vec4 normalOffsets; // about one shadow map texel in world units
+};
+static_assert(offsetof(ShadowCascadesBlock, splits) == 256, "std140 offset mismatch");
+static_assert(offsetof(ShadowCascadesBlock, normalOffsets) == 272, "std140 offset mismatch");
+static_assert(sizeof(ShadowCascadesBlock) == 288, "std140 size mismatch");
+
+// Cascaded shadow maps for the directional light. The view frustum up to SHADOW_DISTANCE is cut
+// into SHADOW_CASCADE_COUNT slices, and each slice gets a layer of one depth texture array:
+//   - fitting: a slice is bounded by a sphere, so its size in light space is the same however the
+//     camera turns, and the orthographic box around it is moved in whole texels; the shadow edges
+//     stay put instead of crawling while the camera moves,
+//   - caching: a layer is rendered CASCADE_MARGIN larger than its slice needs and kept as long as
+//     the slice stays inside it. Only when the slice leaves it, the light turns or setCasterBounds()
+//     reports changed casters is the layer rendered again; the scene's casters are all static.
+// render() draws the casters with a depth-only program into every layer that needs it; its
+// per-cascade render counts and GPU times are kept in stats() for the report.
+class ShadowCascades
+{
+public:
+	static constexpr GLsizei MAP_SIZE = 1024;
+	static constexpr float SHADOW_DISTANCE = 60.0f;
+	static constexpr float CASCADE_MARGIN = 0.25f;
+	// between uniform (0) and logarithmic (1) split distances
+	static constexpr float SPLIT_LAMBDA = 0.75f;
+
+	struct CascadeStats
+	{
+		float splitDepth = 0.0f;
+		unsigned int renders = 0;
+		double lastRenderTime = 0.0; // GPU milliseconds of the last time the layer was drawn
+	};
+
+	ShadowCascades()
+	{
+		glGenTextures(1, &depthArray);
+		// stays bound to SHADOW_MAP_UNIT for the whole run, nothing else uses that unit
+		glState.activeTexture(GL_TEXTURE0 + SHADOW_MAP_UNIT);
+		glState.bindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, MAP_SIZE, MAP_SIZE, SHADOW_CASCADE_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		// sampler2DArrayShadow: the comparison happens in the sampler, with 2x2 PCF from the linear filter
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glState.activeTexture(GL_TEXTURE0);
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::FRAMEBUFFER::SHADOW_CASCADES_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glGenBuffers(1, &UBO);
+		glState.bindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowCascadesBlock), NULL, GL_DYNAMIC_DRAW);
+		glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+		glState.bindBufferBase(GL_UNIFORM_BUFFER, SHADOW_CASCADES_BINDING, UBO);
+		glGenQueries(SHADOW_CASCADE_COUNT, queries);
+	}
+	// free the GL objects, call before the context goes away
+	// ------------------------------------------------------------------------
+	void release()
+	{
+		glState.deleteTextures(1, &depthArray);
+		glDeleteFramebuffers(1, &FBO);
+		glState.deleteBuffers(1, &UBO);
+		glDeleteQueries(SHADOW_CASCADE_COUNT, queries);
+	}
+
+	// the world-space box holding every shadow caster; a new box re-renders every cascade
+	// ------------------------------------------------------------------------
+	void setCasterBounds(const glm::vec3& lower, const glm::vec3& upper)
+	{
+		casterLower = lower;
+		casterUpper = upper;
+		for (Cascade& cascade : cascades)
+			cascade.valid = false;
+	}
+	// fit the cascades to this frame's camera and decide which layers render() has to redraw;
+	// with enabled false the shaders see no cascades and leave everything lit
+	// ------------------------------------------------------------------------
+	void update(bool enabled, const glm::vec3& dirLightDirection, const glm::mat4& view, float fovY, float aspect, float zNear)
+	{
+		const glm::vec3 direction = glm::normalize(dirLightDirection);
+		if (direction != lightDirection)
+		{
+			lightDirection = direction;
+			const glm::vec3 up = std::abs(direction.y) > 0.9f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+			for (Cascade& cascade : cascades)
+				cascade.valid = false;
+		}
+		// the casters' depth range along the light, the same for every cascade; every receiver is one
+		// of the casters, so the slices never need more than that
+		float casterNear = std::numeric_limits<float>::max(), casterFar = -std::numeric_limits<float>::max();
+		for (unsigned int corner = 0; corner < 8; corner++)
+		{
+			const glm::vec3 position((corner & 1) ? casterUpper.x : casterLower.x, (corner & 2) ? casterUpper.y : casterLower.y, (corner & 4) ? casterUpper.z : casterLower.z);
+			const float depth = -(lightView * glm::vec4(position, 1.0f)).z;
+			casterNear = std::min(casterNear, depth);
+			casterFar = std::max(casterFar, depth);
+		}
+
+		const glm::mat4 inverseView = glm::inverse(view);
+		const float tanHalfFovY = std::tan(fovY * 0.5f);
+		float sliceNear = zNear;
+		for (unsigned int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			const float t = (float)(i + 1) / SHADOW_CASCADE_COUNT;
+			const float sliceFar = SPLIT_LAMBDA * zNear * std::pow(SHADOW_DISTANCE / zNear, t) + (1.0f - SPLIT_LAMBDA) * (zNear + (SHADOW_DISTANCE - zNear) * t);
+			Cascade& cascade = cascades[i];
+			cascadeStats[i].splitDepth = block.splits[i] = enabled ? sliceFar : 0.0f;
+			// the slice's bounding sphere, centred on the view axis between its two ends; its radius
+			// only depends on the projection, rounded so float noise never changes the layer size
+			const float nearHalfHeight = sliceNear * tanHalfFovY, farHalfHeight = sliceFar * tanHalfFovY;
+			const float centreDepth = (sliceNear + sliceFar) * 0.5f;
+			const float nearDistance = glm::length(glm::vec3(nearHalfHeight * aspect, nearHalfHeight, centreDepth - sliceNear));
+			const float farDistance = glm::length(glm::vec3(farHalfHeight * aspect, farHalfHeight, sliceFar - centreDepth));
+			const float radius = std::ceil(std::max(nearDistance, farDistance) * 16.0f) / 16.0f;
+			const glm::vec3 centre = glm::vec3(lightView * inverseView * glm::vec4(0.0f, 0.0f, -centreDepth, 1.0f));
+			sliceNear = sliceFar;
+			// keep the layer while the sphere is still inside the box it was rendered with
+			if (cascade.valid && radius == cascade.sliceRadius
+				&& std::abs(centre.x - cascade.centre.x) + radius <= cascade.halfExtent
+				&& std::abs(centre.y - cascade.centre.y) + radius <= cascade.halfExtent)
+				continue;
+
+			// a new box with some margin for the camera to move in, moved in whole texels
+			cascade.sliceRadius = radius;
+			cascade.halfExtent = radius * (1.0f + CASCADE_MARGIN);
+			const float texel = 2.0f * cascade.halfExtent / MAP_SIZE;
+			cascade.centre = glm::vec2(std::floor(centre.x / texel) * texel, std::floor(centre.y / texel) * texel);
+			cascade.valid = false;
+			block.viewProjection[i] = glm::ortho(cascade.centre.x - cascade.halfExtent, cascade.centre.x + cascade.halfExtent,
+				cascade.centre.y - cascade.halfExtent, cascade.centre.y + cascade.halfExtent, casterNear, casterFar) * lightView;
+			block.normalOffsets[i] = texel * 1.5f;
+		}
+		glState.bindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShadowCascadesBlock), &block);
+		glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	// redraw the layers update() invalidated; drawCasters() issues the depth-only draws with
+	// depthShader bound, which gets the cascade's matrix as lightViewProjection. The viewport is
+	// set back to the framebuffer size afterwards.
+	// ------------------------------------------------------------------------
+	template <typename DrawCasters>
+	unsigned int render(const Shader& depthShader, DrawCasters&& drawCasters, int framebufferWidth, int framebufferHeight)
+	{
+		collectTimings();
+		unsigned int rendered = 0;
+		for (unsigned int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			if (cascades[i].valid)
+				continue;
+			if (rendered++ == 0)
+			{
+				glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+				glViewport(0, 0, MAP_SIZE, MAP_SIZE);
+				// slope scaled bias against acne; the normal offset in the shader handles the rest
+				glState.enable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(2.0f, 4.0f);
+				depthShader.use();
+			}
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, i);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			// a layer redrawn before its last timing came back goes untimed rather than reusing the query
+			const bool timed = !queryPending[i];
+			if (timed)
+				glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+			depthShader.setMat4("lightViewProjection"_u, block.viewProjection[i]);
+			drawCasters();
+			if (timed)
+			{
+				glEndQuery(GL_TIME_ELAPSED);
+				queryPending[i] = true;
+			}
+			cascades[i].valid = true;
+			cascadeStats[i].renders++;
+		}
+		if (rendered > 0)
+		{
+			glState.disable(GL_POLYGON_OFFSET_FILL);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glViewport(0, 0, framebufferWidth, framebufferHeight);
+		}
+		return rendered;
+	}
+	const CascadeStats* stats() const { return cascadeStats; }
+
+private:
+	struct Cascade
+	{
+		bool valid = false;
+		float sliceRadius = 0.0f;
+		float halfExtent = 0.0f; // of the light-space box the layer was rendered with
+		glm::vec2 centre = glm::vec2(0.0f);
+	};
+	Cascade cascades[SHADOW_CASCADE_COUNT];
+	CascadeStats cascadeStats[SHADOW_CASCADE_COUNT];
+	ShadowCascadesBlock block{};
+	glm::vec3 lightDirection = glm::vec3(0.0f);
+	glm::mat4 lightView = glm::mat4(1.0f);
+	glm::vec3 casterLower = glm::vec3(0.0f), casterUpper = glm::vec3(0.0f);
+	unsigned int depthArray, FBO, UBO;
+	unsigned int queries[SHADOW_CASCADE_COUNT];
+	bool queryPending[SHADOW_CASCADE_COUNT] = {};
+
+	// pick up the timings the GPU has finished, the others stay pending; never waits
+	void collectTimings()
+	{
+		for (unsigned int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			if (!queryPending[i])
+				continue;
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+			cascadeStats[i].lastRenderTime = elapsed * 1e-6;
+			queryPending[i] = false;
+		}
+	}
+};
+#endif
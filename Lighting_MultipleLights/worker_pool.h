@@ -0,0 +1,102 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+// Threads started once and parked on a condition variable between jobs, for the per-frame work
+// that is split over the cores (light clusters, occluder rasterisation) and would otherwise pay for
+// creating and joining its threads every frame. run(count, work) calls work(0) .. work(count - 1)
+// each on its own thread at the same time, work(0) on the caller, and returns once they all have,
+// so the calls may wait on each other (a std::barrier over count threads is fine).
+class WorkerPool
+{
+public:
+	// threads counts the caller, so threads - 1 are started
+	explicit WorkerPool(unsigned int threads = std::max(1u, std::thread::hardware_concurrency()))
+	{
+		for (unsigned int t = 1; t < threads; t++)
+			threads_.emplace_back([this, t]() { loop(t); });
+	}
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& thread : threads_)
+			thread.join();
+	}
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// most calls run() can run at once, the caller included
+	unsigned int size() const { return (unsigned int)threads_.size() + 1; }
+
+	// count is clamped to [1, size()]; work must be callable as work(unsigned int)
+	// ------------------------------------------------------------------------
+	template <typename Work>
+	void run(unsigned int count, Work&& work)
+	{
+		count = std::clamp(count, 1u, size());
+		if (count > 1)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job = (void*)&work;
+				invoke = [](void* context, unsigned int index) { (*static_cast<std::remove_reference_t<Work>*>(context))(index); };
+				active = count;
+				running = count - 1;
+				generation++;
+			}
+			wake.notify_all();
+		}
+		work(0u);
+		if (count > 1)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [this]() { return running == 0; });
+		}
+	}
+
+private:
+	std::vector<std::thread> threads_;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	// the current job, type erased without allocating; guarded by mutex
+	void* job = nullptr;
+	void (*invoke)(void*, unsigned int) = nullptr;
+	unsigned int active = 0;  // threads taking part, indices below it
+	unsigned int running = 0; // of those besides the caller, how many have not finished
+	std::uint64_t generation = 0;
+	bool stopping = false;
+
+	void loop(unsigned int index)
+	{
+		std::uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			wake.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+			if (index >= active)
+				continue;
+			void* current = job;
+			void (*call)(void*, unsigned int) = invoke;
+			lock.unlock();
+			call(current, index);
+			lock.lock();
+			if (--running == 0)
+				done.notify_one();
+		}
+	}
+};
+#endif
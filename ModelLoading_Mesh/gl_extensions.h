@@ -0,0 +1,79 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// glad.c is generated for the plain GL 3.3 core profile, so anything newer is loaded here by hand.
+// Every entry point below is optional: it stays NULL unless the driver exposes it, check the
+// matching GLAD_GL_* flag before calling it. Naming follows glad so call sites read like core GL.
+
+// GL_ARB_multi_draw_indirect (core in 4.3), together with GL_ARB_draw_indirect (core in 4.0) for
+// the buffer binding and GL_ARB_base_instance (core in 4.2) so a command's baseInstance is honoured
+// ------------------------------------------------------------------------
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#define GL_DRAW_INDIRECT_BUFFER_BINDING 0x8F43
+#endif
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+inline int GLAD_GL_ARB_multi_draw_indirect = 0;
+inline PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect = NULL;
+#define glMultiDrawElementsIndirect glad_glMultiDrawElementsIndirect
+
+// one draw of glMultiDrawElementsIndirect, laid out as the spec reads it from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// GL_ARB_copy_image (core in 4.3), texel copies between textures without a trip through the CPU
+// ------------------------------------------------------------------------
+typedef void (APIENTRYP PFNGLCOPYIMAGESUBDATAPROC)(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ,
+	GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+inline int GLAD_GL_ARB_copy_image = 0;
+inline PFNGLCOPYIMAGESUBDATAPROC glad_glCopyImageSubData = NULL;
+#define glCopyImageSubData glad_glCopyImageSubData
+
+// utility queries
+// ------------------------------------------------------------------------
+inline bool hasGLExtension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+		if (extension != NULL && std::strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+inline bool hasGLVersion(int major, int minor)
+{
+	GLint contextMajor = 0, contextMinor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+	glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+	return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+// call once right after gladLoadGLLoader, with the same loader
+// ------------------------------------------------------------------------
+inline void loadGLExtensions(GLADloadproc load)
+{
+	if (hasGLVersion(4, 3) || (hasGLExtension("GL_ARB_multi_draw_indirect") && hasGLExtension("GL_ARB_base_instance")))
+	{
+		glad_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)load("glMultiDrawElementsIndirect");
+		GLAD_GL_ARB_multi_draw_indirect = glad_glMultiDrawElementsIndirect != NULL;
+	}
+	if (hasGLVersion(4, 3) || hasGLExtension("GL_ARB_copy_image"))
+	{
+		glad_glCopyImageSubData = (PFNGLCOPYIMAGESUBDATAPROC)load("glCopyImageSubData");
+		GLAD_GL_ARB_copy_image = glad_glCopyImageSubData != NULL;
+	}
+}
+#endif
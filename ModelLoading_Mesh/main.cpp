@@ -8,6 +8,9 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+// mesh.h includes the declarations, the implementation goes in this translation unit
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
 
 #include <iostream>
 #include <string>
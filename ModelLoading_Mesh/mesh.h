@@ -8,12 +8,25 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <stb_image.h>
 
 #include "shaders.h"
 #include "camera.h"
+#include "normal_matrix.h"
+#include "gl_extensions.h"
+#include "gl_state_cache.h"
 
 #include <string>
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MODEL_LOADING_MESH_SSE
+#endif
 using std::string, std::cout, std::endl, std::vector, glm::vec3, glm::vec2;
 
 struct Vertex {
@@ -25,6 +38,19 @@ struct Vertex {
 struct Texture {
     unsigned int id;
     string type;
+    string path; // as the material names it, relative to the model
+};
+
+// axis aligned bounding box, for culling
+struct Aabb {
+    glm::vec3 lower = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 upper = glm::vec3(-std::numeric_limits<float>::max());
+
+    void expand(const Aabb& other)
+    {
+        lower = glm::min(lower, other.lower);
+        upper = glm::max(upper, other.upper);
+    }
 };
 
 class Mesh {
@@ -32,62 +58,319 @@ public:
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
+    unsigned int materialIndex = 0; // the scene's material, handed to the shader per draw
+    Aabb bounds; // model space, around every vertex
+    // where the owning Model put this mesh in its shared vertex and index buffers
+    unsigned int firstIndex = 0;
+    int baseVertex = 0;
+    // where its textures went when the owning Model packed them into texture arrays, -1 for none
+    int textureArray = -1;
+    glm::ivec2 textureLayers = glm::ivec2(-1); // texture_diffuse1, texture_specular1
 
-    explicit Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures) 
-        : vertices(vertices), indices(indices), textures(textures)
+    // the mesh owns no GL objects, Model uploads every mesh into one set of buffers
+    Mesh() = default;
+    explicit Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, unsigned int materialIndex = 0)
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), materialIndex(materialIndex)
     {
-        setupMesh();
+        for (const Vertex& vertex : this->vertices)
+            bounds.expand({ vertex.Position, vertex.Position });
     }
-    ~Mesh() = default;
-    Mesh(const Mesh& rhs) = delete; // not needed so far
-    Mesh& operator=(const Mesh& rhs) = delete;
-    Mesh& operator=(Mesh&& rhs) = delete;
 
+    // meshes sharing the same textures can go in one multi-draw
+    bool sameTextures(const Mesh& other) const
+    {
+        if (textures.size() != other.textures.size())
+            return false;
+        for (size_t i = 0; i < textures.size(); i++)
+            if (textures[i].id != other.textures[i].id || textures[i].type != other.textures[i].type)
+                return false;
+        return true;
+    }
+};
 
-    void Draw(const Shader& shader)
-{
-        /* Example code of shader
-            uniform sampler2D texture_diffuse1;
-            uniform sampler2D texture_diffuse2;
-            uniform sampler2D texture_specular1;
-            uniform sampler2D texture_specular2;*/
+// A mesh's textures resolved against one shader: the unit each texture goes on and the location of
+// the sampler it is read through, looked up once so that binding them allocates nothing and compares
+// no strings. The n-th texture of a type is sampled through "material.<type><n>", a model's texture
+// array through "material.textures" (a sampler2DArray) instead.
+/* Example code of shader
+    uniform sampler2D texture_diffuse1;
+    uniform sampler2D texture_diffuse2;
+    uniform sampler2D texture_specular1;
+    uniform sampler2D texture_specular2;*/
+class Material {
+public:
+    static constexpr unsigned int MAX_TEXTURES = 16; // texture i goes on GL_TEXTURE0 + i
+
+    GLuint program = 0; // the shader the sampler locations belong to
+
+    Material() = default;
+    Material(const vector<Texture>& textures, const Shader& shader) : program(shader.ID)
+    {
+        if (textures.size() > MAX_TEXTURES)
+            cout << "ERROR::MATERIAL::TOO_MANY_TEXTURES" << endl;
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
-        for (unsigned int i = 0; i < this->textures.size(); i++)
+        for (size_t i = 0; i < textures.size() && count < MAX_TEXTURES; i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i);
-            
             string number; // current texture indice
-            string name = textures[i].type;
+            const string& name = textures[i].type;
             if (name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if (name == "texture_specular")
                 number = std::to_string(specularNr++);
+            slots[count++] = { GL_TEXTURE_2D, textures[i].id, glGetUniformLocation(shader.ID, ("material." + name + number).c_str()) };
+        }
+    }
+    Material(GLuint textureArray, const Shader& shader) : program(shader.ID)
+    {
+        slots[count++] = { GL_TEXTURE_2D_ARRAY, textureArray, glGetUniformLocation(shader.ID, "material.textures") };
+    }
 
-            shader.setInt(("material." + name + number).c_str(), i);
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+    // the textures on their units and every sampler pointed at its unit, the shader must be in use
+    void bind() const
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            glState.activeTexture(GL_TEXTURE0 + i);
+            glState.bindTexture(slots[i].target, slots[i].texture);
+            glUniform1i(slots[i].location, (GLint)i);
         }
-        glActiveTexture(GL_TEXTURE0);
+        glState.activeTexture(GL_TEXTURE0);
+    }
+
+private:
+    struct Slot
+    {
+        GLenum target;
+        GLuint texture;
+        GLint location; // -1 when the shader has no such sampler, glUniform1i ignores it then
+    };
+    Slot slots[MAX_TEXTURES] = {};
+    unsigned int count = 0;
+};
 
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+// load an image next to the model into a mipmapped 2D texture, 0 when it cannot be read
+inline unsigned int TextureFromFile(const char* path, const string& directory)
+{
+    string filename = directory + '/' + path;
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    int width, height, nrComponents;
+    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+    if (data)
+    {
+        GLenum format = GL_RGBA;
+        if (nrComponents == 1)
+            format = GL_RED;
+        else if (nrComponents == 3)
+            format = GL_RGB;
+
+        glState.bindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        stbi_image_free(data);
+    }
+    else
+    {
+        std::cout << "Texture failed to load at path: " << filename << std::endl;
+        glState.deleteTextures(1, &textureID);
+        textureID = 0;
+    }
+
+    return textureID;
+}
+
+// All meshes of a model live in one vertex buffer and one index buffer behind a single VAO. Draw()
+// issues one glMultiDrawElementsIndirect per run of meshes with the same textures, so a model of
+// thousands of meshes costs a handful of calls. Without GL 4.3 it falls back to one
+// glDrawElementsBaseVertex per mesh, still without rebinding buffers.
+// With textureArrays the model copies its textures into GL_TEXTURE_2D_ARRAYs, one per size and
+// format, and a run then only ends where the array changes: usually the whole model is one call,
+// whatever its materials. Each mesh reads its layers from aTextureLayers. Compressed textures,
+// more than one texture of a type or types other than diffuse and specular keep the model on
+// plain 2D textures, usesTextureArrays() tells which path it got.
+// Vertex shader inputs:
+//     layout (location = 0) in vec3 aPos;
+//     layout (location = 1) in vec3 aNormal;
+//     layout (location = 2) in vec2 aTexCoords;
+//     layout (location = 3) in uint aMaterial; // the mesh's materialIndex, pass it on as flat
+//     layout (location = 4) in ivec2 aTextureLayers; // diffuse and specular layer, -1 for none
+// Both come from a per-draw buffer stepped once per instance: every indirect command draws a
+// single instance with baseInstance set to its draw index, which is what gl_DrawID would give on
+// GL 4.6 without needing it.
+// Call loadGLExtensions() before loading a model, the path is picked when the buffers are made.
+class Model
+{
+public:
+    static constexpr GLuint MATERIAL_ATTRIB = 3;
+    static constexpr GLuint TEXTURE_LAYERS_ATTRIB = 4;
+
+    Aabb bounds; // model space, around every mesh
+
+    // the meshes are converted on loadThreads threads, all of hardware_concurrency() for 0
+    Model(char* path, bool textureArrays = false, unsigned int loadThreads = 0)
+    {
+        loadModel(path, loadThreads);
+        setupBuffers(textureArrays);
+    }
+    ~Model() = default;
+    Model(const Model& rhs) = delete; // owns GL objects, see release()
+    Model& operator=(const Model& rhs) = delete;
+
+    // model and normal matrix are set once for the whole model, every mesh shares them
+    void Draw(const Shader& shader, const glm::mat4& model)
+    {
+        if (meshes.empty())
+            return;
+        shader.setMat4("model", model);
+        shader.setMat3("normalMatrix", normalMatrix(model));
+        const vector<Material>& batchMaterials = materialsFor(shader);
+        glState.bindVertexArray(VAO);
+        if (multiDraw)
+        {
+            glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            for (size_t b = 0; b < batches.size(); b++)
+            {
+                const Batch& batch = batches[b];
+                batchMaterials[b].bind();
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                    (void*)(batch.first * sizeof(DrawElementsIndirectCommand)), (GLsizei)batch.count, 0);
+            }
+            glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+        else
+        {
+            for (size_t b = 0; b < batches.size(); b++)
+            {
+                const Batch& batch = batches[b];
+                batchMaterials[b].bind();
+                for (size_t i = batch.first; i < batch.first + batch.count; i++)
+                {
+                    // the attribute array stays disabled on this path, the current value stands in for it
+                    glVertexAttribI1ui(MATERIAL_ATTRIB, meshes[i].materialIndex);
+                    glVertexAttribI2i(TEXTURE_LAYERS_ATTRIB, meshes[i].textureLayers.x, meshes[i].textureLayers.y);
+                    glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)meshes[i].indices.size(), GL_UNSIGNED_INT,
+                        (void*)(meshes[i].firstIndex * sizeof(unsigned int)), meshes[i].baseVertex);
+                }
+            }
+        }
+        // the VAO stays bound, the next Draw() of this model skips binding it again
+    }
+    // GL calls issued by one Draw(), not counting the two uniforms
+    size_t drawCallCount() const { return multiDraw ? batches.size() : meshes.size(); }
+    bool usesTextureArrays() const { return !textureArrays.empty(); }
+    // delete the GL objects while the context is still current
+    void release()
+    {
+        glState.deleteVertexArrays(1, &VAO);
+        glState.deleteBuffers(1, &VBO);
+        glState.deleteBuffers(1, &EBO);
+        glState.deleteBuffers(1, &materialBuffer);
+        glState.deleteBuffers(1, &commandBuffer);
+        if (!textureArrays.empty())
+            glState.deleteTextures((GLsizei)textureArrays.size(), textureArrays.data());
+        // the 2D textures, none left once they were packed into arrays; 0 is a texture that failed to load
+        vector<GLuint> loaded;
+        for (const Texture& texture : texturesLoaded)
+            if (texture.id != 0)
+                loaded.push_back(texture.id);
+        if (!loaded.empty())
+            glState.deleteTextures((GLsizei)loaded.size(), loaded.data());
+        VAO = VBO = EBO = materialBuffer = commandBuffer = 0;
+        materials.clear();
+        textureArrays.clear();
+        texturesLoaded.clear();
     }
 
 private:
-    unsigned int VAO, VBO, EBO;
+    // meshes[first, first + count) share their textures
+    struct Batch
+    {
+        size_t first;
+        size_t count;
+    };
+    vector<Mesh> meshes;
+    vector<Batch> batches;
+    vector<Texture> texturesLoaded; // every 2D texture the materials named so far, none once packed into arrays
+    vector<GLuint> textureArrays; // indexed by Mesh::textureArray, empty on the 2D texture path
+    // one Material per batch for every shader the model was drawn with, built on its first Draw()
+    vector<vector<Material>> materials;
+    string directory;
+    unsigned int VAO = 0, VBO = 0, EBO = 0, materialBuffer = 0, commandBuffer = 0;
+    bool multiDraw = false;
+
+    // the batches' textures resolved against shader, the strings are only built the first time
+    const vector<Material>& materialsFor(const Shader& shader)
+    {
+        for (const vector<Material>& resolved : materials)
+            if (resolved.front().program == shader.ID)
+                return resolved;
+        vector<Material> resolved;
+        for (const Batch& batch : batches)
+        {
+            const Mesh& mesh = meshes[batch.first];
+            if (mesh.textureArray >= 0)
+                resolved.emplace_back(textureArrays[mesh.textureArray], shader);
+            else
+                resolved.emplace_back(mesh.textures, shader);
+        }
+        materials.push_back(std::move(resolved));
+        return materials.back();
+    }
 
-    void setupMesh()
+    // sub-allocate every mesh from the shared buffers and record the draws
+    void setupBuffers(bool packTextures)
     {
+        if (meshes.empty())
+            return;
+        if (packTextures)
+            packTextureArrays();
+        // keep meshes that can share a draw next to each other, in scene order otherwise
+        const bool arrays = !textureArrays.empty();
+        std::stable_sort(meshes.begin(), meshes.end(), [arrays](const Mesh& a, const Mesh& b)
+            {
+                if (arrays)
+                    return a.textureArray < b.textureArray;
+                return std::lexicographical_compare(a.textures.begin(), a.textures.end(), b.textures.begin(), b.textures.end(),
+                    [](const Texture& x, const Texture& y) { return x.id != y.id ? x.id < y.id : x.type < y.type; });
+            });
+        size_t vertexCount = 0, indexCount = 0;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshes[i].baseVertex = (int)vertexCount;
+            meshes[i].firstIndex = (unsigned int)indexCount;
+            vertexCount += meshes[i].vertices.size();
+            indexCount += meshes[i].indices.size();
+            const Mesh& first = meshes[i == 0 ? 0 : batches.back().first];
+            if (i == 0 || (arrays ? meshes[i].textureArray != first.textureArray : !meshes[i].sameTextures(first)))
+                batches.push_back({ i, 0 });
+            batches.back().count++;
+        }
+
+        multiDraw = GLAD_GL_ARB_multi_draw_indirect != 0;
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-            &indices[0], GL_STATIC_DRAW);
+        glState.bindVertexArray(VAO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+        for (const Mesh& mesh : meshes)
+        {
+            if (!mesh.vertices.empty())
+                glBufferSubData(GL_ARRAY_BUFFER, mesh.baseVertex * sizeof(Vertex), mesh.vertices.size() * sizeof(Vertex), mesh.vertices.data());
+            if (!mesh.indices.empty())
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mesh.firstIndex * sizeof(unsigned int), mesh.indices.size() * sizeof(unsigned int), mesh.indices.data());
+        }
 
         glEnableVertexAttribArray(0); // Vertex
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -98,24 +381,158 @@ private:
         glEnableVertexAttribArray(2); // Texcoord
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 
-        glBindVertexArray(0);
+        if (multiDraw)
+        {
+            // draw i reads drawMaterials[i] through its baseInstance
+            struct DrawMaterial
+            {
+                GLuint materialIndex;
+                glm::ivec2 textureLayers;
+            };
+            vector<DrawMaterial> drawMaterials;
+            vector<DrawElementsIndirectCommand> commands;
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                drawMaterials.push_back({ meshes[i].materialIndex, meshes[i].textureLayers });
+                commands.push_back({ (GLuint)meshes[i].indices.size(), 1, meshes[i].firstIndex, meshes[i].baseVertex, (GLuint)i });
+            }
+            glGenBuffers(1, &materialBuffer);
+            glState.bindBuffer(GL_ARRAY_BUFFER, materialBuffer);
+            glBufferData(GL_ARRAY_BUFFER, drawMaterials.size() * sizeof(DrawMaterial), drawMaterials.data(), GL_STATIC_DRAW);
+            glEnableVertexAttribArray(MATERIAL_ATTRIB); // Material
+            glVertexAttribIPointer(MATERIAL_ATTRIB, 1, GL_UNSIGNED_INT, sizeof(DrawMaterial), (void*)offsetof(DrawMaterial, materialIndex));
+            glVertexAttribDivisor(MATERIAL_ATTRIB, 1);
+            glEnableVertexAttribArray(TEXTURE_LAYERS_ATTRIB); // Texture layers
+            glVertexAttribIPointer(TEXTURE_LAYERS_ATTRIB, 2, GL_INT, sizeof(DrawMaterial), (void*)offsetof(DrawMaterial, textureLayers));
+            glVertexAttribDivisor(TEXTURE_LAYERS_ATTRIB, 1);
+
+            glGenBuffers(1, &commandBuffer);
+            glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+            glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+        glState.bindVertexArray(0);
+        glState.bindBuffer(GL_ARRAY_BUFFER, 0);
     }
-};
 
-class Model
-{
-public:
-    Model(char* path)
+    // copy the textures into one GL_TEXTURE_2D_ARRAY per size and format and note every mesh's
+    // layers; leaves the meshes alone when one of them has textures the arrays cannot stand in for
+    void packTextureArrays()
     {
-        loadModel(path);
-    }
-    void Draw(Shader shader);
+        struct Layout
+        {
+            GLint width, height, format;
+            vector<GLuint> layers; // texture names, in layer order
+        };
+        vector<Layout> layouts;
+        vector<std::pair<int, glm::ivec2>> placement; // (layout, layers) per mesh
+        GLint maxLayers = 256;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        for (const Mesh& mesh : meshes)
+        {
+            int layout = -1;
+            glm::ivec2 layers(-1);
+            for (const Texture& texture : mesh.textures)
+            {
+                int& layer = texture.type == "texture_diffuse" ? layers.x : layers.y;
+                if ((texture.type != "texture_diffuse" && texture.type != "texture_specular") || layer >= 0)
+                    return;
+                GLint width = 0, height = 0, format = 0, compressed = GL_FALSE;
+                glState.bindTexture(GL_TEXTURE_2D, texture.id);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+                if (width == 0 || height == 0 || compressed)
+                    return;
+                // the texture's layer if it is packed already, else a new one in the first array with room
+                int found = -1;
+                for (size_t l = 0; l < layouts.size() && found < 0; l++)
+                {
+                    Layout& candidate = layouts[l];
+                    if (candidate.width != width || candidate.height != height || candidate.format != format)
+                        continue;
+                    auto it = std::find(candidate.layers.begin(), candidate.layers.end(), texture.id);
+                    if (it != candidate.layers.end())
+                        layer = (int)(it - candidate.layers.begin());
+                    else if ((GLint)candidate.layers.size() < maxLayers && (layout < 0 || layout == (int)l))
+                    {
+                        layer = (int)candidate.layers.size();
+                        candidate.layers.push_back(texture.id);
+                    }
+                    else
+                        continue;
+                    found = (int)l;
+                }
+                if (found < 0)
+                {
+                    layouts.push_back({ width, height, format, { texture.id } });
+                    found = (int)layouts.size() - 1;
+                    layer = 0;
+                }
+                // a draw samples a single array
+                if (layout >= 0 && layout != found)
+                    return;
+                layout = found;
+            }
+            placement.push_back({ layout, layers });
+        }
 
-private:
-    vector<Mesh> meshes;
-    string directory;
+        vector<unsigned char> pixels;
+        for (const Layout& layout : layouts)
+        {
+            GLuint textureArray;
+            glGenTextures(1, &textureArray);
+            glState.bindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, layout.format, layout.width, layout.height, (GLsizei)layout.layers.size(),
+                0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            // without mipmaps yet, glCopyImageSubData refuses incomplete textures
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            for (size_t layer = 0; layer < layout.layers.size(); layer++)
+            {
+                if (GLAD_GL_ARB_copy_image)
+                {
+                    glCopyImageSubData(layout.layers[layer], GL_TEXTURE_2D, 0, 0, 0, 0,
+                        textureArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)layer, layout.width, layout.height, 1);
+                    continue;
+                }
+                // GL 3.3 has no texture to texture copy, go through memory
+                pixels.resize((size_t)layout.width * layout.height * 4);
+                glState.bindTexture(GL_TEXTURE_2D, layout.layers[layer]);
+                glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)layer, layout.width, layout.height, 1,
+                    GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            }
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            textureArrays.push_back(textureArray);
+        }
+        // meshes without textures sample nothing and can join any draw
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshes[i].textureArray = textureArrays.empty() ? -1 : std::max(placement[i].first, 0);
+            meshes[i].textureLayers = placement[i].second;
+            meshes[i].textures.clear(); // the names below are deleted, textureLayers says where they went
+        }
+        // every texture is a layer now, the 2D originals are only taking up memory
+        vector<GLuint> packed;
+        for (const Layout& layout : layouts)
+            packed.insert(packed.end(), layout.layers.begin(), layout.layers.end());
+        if (!packed.empty())
+            glState.deleteTextures((GLsizei)packed.size(), packed.data());
+        texturesLoaded.erase(std::remove_if(texturesLoaded.begin(), texturesLoaded.end(),
+            [&](const Texture& texture) { return std::find(packed.begin(), packed.end(), texture.id) != packed.end(); }),
+            texturesLoaded.end());
+    }
 
-    void loadModel(string path)
+    // Everything but the GL work runs on worker threads: the hierarchy is flattened into the list of
+    // meshes to convert, the materials' textures are loaded here on the context thread, then the
+    // workers take meshes off a shared counter and build their vertices, indices and bounds.
+    // setupBuffers() uploads the result afterwards, again on the context thread.
+    void loadModel(string path, unsigned int loadThreads)
     {
         Assimp::Importer import;
         const aiScene * scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
@@ -127,56 +544,150 @@ private:
         }
         this->directory = path.substr(0, path.find_last_of('/'));
 
-        processNode(scene->mRootNode, scene);
+        vector<const aiMesh*> sceneMeshes;
+        processNode(scene->mRootNode, scene, sceneMeshes);
+        vector<vector<Texture>> materialTextures(scene->mNumMaterials);
+        vector<bool> materialLoaded(scene->mNumMaterials, false);
+        for (const aiMesh* mesh : sceneMeshes)
+        {
+            if (mesh->mMaterialIndex >= scene->mNumMaterials || materialLoaded[mesh->mMaterialIndex])
+                continue;
+            materialLoaded[mesh->mMaterialIndex] = true;
+            materialTextures[mesh->mMaterialIndex] = processMaterial(scene->mMaterials[mesh->mMaterialIndex]);
+        }
+
+        meshes.resize(sceneMeshes.size());
+        const unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+        const unsigned int threadCount = (unsigned int)std::clamp<size_t>(loadThreads != 0 ? loadThreads : hardwareThreads, 1, std::max<size_t>(sceneMeshes.size(), 1));
+        // meshes differ a lot in size, so each worker takes the next one when it is done instead of a fixed share
+        std::atomic<size_t> next = 0;
+        const vector<Texture> noTextures;
+        auto work = [&]()
+        {
+            for (size_t i = next++; i < sceneMeshes.size(); i = next++)
+            {
+                const aiMesh* mesh = sceneMeshes[i];
+                meshes[i] = processMesh(mesh, mesh->mMaterialIndex < materialTextures.size() ? materialTextures[mesh->mMaterialIndex] : noTextures);
+            }
+        };
+        // started for this load and joined, not a persistent pool: a model loads once, so the thread
+        // start-up is paid once per model rather than every frame like Lighting_MultipleLights' WorkerPool
+        vector<std::thread> threads;
+        for (unsigned int t = 1; t < threadCount; t++)
+            threads.emplace_back(work);
+        work();
+        for (std::thread& thread : threads)
+            thread.join();
+
+        for (const Mesh& mesh : meshes)
+            bounds.expand(mesh.bounds);
     }
 
-    void processNode(aiNode* node, const aiScene* scene)
+    // the meshes below node in scene order, children after their parent
+    void processNode(const aiNode* node, const aiScene* scene, vector<const aiMesh*>& sceneMeshes)
     {
         // ڵееĻ
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
-        {
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            this->meshes.push_back(processMesh(mesh, scene));
-        }
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
         // ӽڵظһ
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, sceneMeshes);
         }
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    // 
+    // touches GL, so it stays on the context thread
+    vector<Texture> processMaterial(aiMaterial* material)
     {
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
+        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
         vector<Texture> textures;
+        textures.reserve(diffuseMaps.size() + specularMaps.size());
+        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        return textures;
+    }
 
-        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+    // no GL and no shared state, safe on any thread
+    static Mesh processMesh(const aiMesh* mesh, const vector<Texture>& textures)
+    {
+        // every array is sized once up front and written in place
+        vector<Vertex> vertices(mesh->mNumVertices);
+        vector<unsigned int> indices;
+
+        copyVertices(mesh, vertices.data());
+        // 
+        // faces are triangles after aiProcess_Triangulate, point and line primitives have fewer indices
+        size_t indexCount = 0;
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+            indexCount += mesh->mFaces[i].mNumIndices;
+        indices.resize(indexCount);
+        unsigned int* index = indices.data();
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            Vertex vertex;
+            const aiFace& face = mesh->mFaces[i];
+            index = std::copy(face.mIndices, face.mIndices + face.mNumIndices, index);
+        }
 
-            glm::vec3 vector;
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
+        return Mesh(std::move(vertices), std::move(indices), textures, mesh->mMaterialIndex);
+    }
 
-            vertex.Position = vector;
-            vertices.push_back(vertex);
-        }
-        // 
-        //TODO
-            // 
-            if (mesh->mMaterialIndex >= 0)
+    // aiMesh keeps positions, normals and texture coordinates in separate aiVector3D arrays, Vertex
+    // interleaves them; a mesh without normals or texture coordinates gets zeros there
+    static void copyVertices(const aiMesh* mesh, Vertex* vertices)
+    {
+        static_assert(sizeof(aiVector3D) == 3 * sizeof(float) && sizeof(Vertex) == 8 * sizeof(float), "tightly packed floats");
+        const aiVector3D* positions = mesh->mVertices;
+        const aiVector3D* normals = mesh->mNormals;
+        const aiVector3D* texCoords = mesh->mTextureCoords[0];
+        unsigned int i = 0;
+#ifdef MODEL_LOADING_MESH_SSE
+        if (normals != NULL && texCoords != NULL)
+        {
+            // a vertex is two 4-float stores, position with normal.x and normal.yz with texcoord.xy;
+            // each load reads one float into the next vertex, so the last one is left to the loop below
+            for (; i + 1 < mesh->mNumVertices; i++)
             {
-                //TODO
+                const __m128 position = _mm_loadu_ps(&positions[i].x);
+                const __m128 normal = _mm_loadu_ps(&normals[i].x);
+                const __m128 normalYZ = _mm_loadu_ps(&normals[i].y);
+                const __m128 texCoord = _mm_loadu_ps(&texCoords[i].x);
+                const __m128 zx = _mm_shuffle_ps(position, normal, _MM_SHUFFLE(0, 0, 2, 2)); // p.z, p.z, n.x, n.x
+                float* out = &vertices[i].Position.x;
+                _mm_storeu_ps(out, _mm_shuffle_ps(position, zx, _MM_SHUFFLE(2, 0, 1, 0)));
+                _mm_storeu_ps(out + 4, _mm_shuffle_ps(normalYZ, texCoord, _MM_SHUFFLE(1, 0, 1, 0)));
             }
-
-        return Mesh(vertices, indices, textures);
+        }
+#endif
+        for (; i < mesh->mNumVertices; i++)
+        {
+            vertices[i].Position = glm::vec3(positions[i].x, positions[i].y, positions[i].z);
+            vertices[i].Normal = normals != NULL ? glm::vec3(normals[i].x, normals[i].y, normals[i].z) : glm::vec3(0.0f);
+            vertices[i].TexCoords = texCoords != NULL ? glm::vec2(texCoords[i].x, texCoords[i].y) : glm::vec2(0.0f);
+        }
     }
 
+    // textures shared between materials are loaded once
     vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
     {
-
+        vector<Texture> textures;
+        for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        {
+            aiString str;
+            mat->GetTexture(type, i, &str);
+            auto loaded = std::find_if(texturesLoaded.begin(), texturesLoaded.end(),
+                [&](const Texture& texture) { return texture.path == str.C_Str(); });
+            if (loaded != texturesLoaded.end())
+            {
+                textures.push_back({ loaded->id, typeName, loaded->path });
+                continue;
+            }
+            Texture texture = { TextureFromFile(str.C_Str(), directory), typeName, str.C_Str() };
+            textures.push_back(texture);
+            texturesLoaded.push_back(texture);
+        }
+        return textures;
     }
 };
 
@@ -3,6 +3,7 @@
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include "gl_state_cache.h"
 
 #include <string>
 #include <fstream>
@@ -74,7 +75,7 @@ public:
 	// ------------------------------------------------------------------------
 	void use() const
 	{
-		glUseProgram(ID);
+		glState.useProgram(ID);
 	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------